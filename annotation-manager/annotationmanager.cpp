@@ -4,102 +4,109 @@
 #include <QClipboard>
 #include <QColorSpace>
 #include <QDir>
+#include <QDockWidget>
 #include <QFileDialog>
+#include <QFutureWatcher>
 #include <QImageReader>
 #include <QImageWriter>
+#include <QInputDialog>
 #include <QLabel>
 #include <QMenuBar>
 #include <QMessageBox>
 #include <QMimeData>
 #include <QPainter>
+#include <QProgressBar>
 #include <QScreen>
 #include <QScrollArea>
 #include <QScrollBar>
 #include <QStandardPaths>
 #include <QStatusBar>
 #include <QSplitter>
+#include <QToolButton>
+#include <QtConcurrent/QtConcurrentRun>
 
+#include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <queue>
 #include <utility>
 #include <cmath>
+#include <cstring>
+
+#include "brushstroke.h"
+#include "rawdecode.h"
+#include "slicerender.h"
 
 
 AnnotationManager::AnnotationManager(QWidget *parent)
-        : QMainWindow(parent), imageLabel(new QLabel), comparisonImageLabel(new QLabel)
+        : QMainWindow(parent), imageView(new ImageView), comparisonImageView(new ImageView)
         , scrollArea(new QScrollArea), comparisonScrollArea(new QScrollArea), splitter(new QSplitter)
 {
-    imageLabel->setBackgroundRole(QPalette::Base);
-    imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    imageLabel->setScaledContents(true);
+    imageView->setBackgroundRole(QPalette::Base);
+    imageView->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
 
     scrollArea->setBackgroundRole(QPalette::Dark);
-    scrollArea->setWidget(imageLabel);
+    scrollArea->setWidget(imageView);
     scrollArea->setVisible(false);
 
     splitter->addWidget(scrollArea);
 
-    comparisonImageLabel->setBackgroundRole(QPalette::Base);
-    comparisonImageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    comparisonImageLabel->setScaledContents(true);
+    comparisonImageView->setBackgroundRole(QPalette::Base);
+    comparisonImageView->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
 
     comparisonScrollArea->setBackgroundRole(QPalette::Dark);
-    comparisonScrollArea->setWidget(comparisonImageLabel);
+    comparisonScrollArea->setWidget(comparisonImageView);
     comparisonScrollArea->setVisible(false);
 
     splitter->addWidget(comparisonScrollArea);
 
     setCentralWidget(splitter);
 
+    lesionStats = new LesionStats(&combinedData, this);
+    connect(lesionStats, &LesionStats::lesionsCounted, this, &AnnotationManager::updateLesionStats);
+
+    lesionStatsLabel = new QLabel;
+    lesionStatsLabel->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+    lesionStatsLabel->setMargin(6);
+    lesionStatsDock = new QDockWidget(tr("Lesion statistics"), this);
+    lesionStatsDock->setWidget(lesionStatsLabel);
+    addDockWidget(Qt::RightDockWidgetArea, lesionStatsDock);
+    lesionStatsDock->hide();
+    // lesions are only counted while someone is looking
+    connect(lesionStatsDock, &QDockWidget::visibilityChanged, this, [this](bool visible) {
+        lesionStats->setEnabled(visible);
+        updateLesionStats();
+    });
+
     createActions();
 
+    loadProgressBar = new QProgressBar;
+    loadProgressBar->setMaximumWidth(200);
+    loadProgressBar->setVisible(false);
+    statusBar()->addPermanentWidget(loadProgressBar);
+
+    cancelLoadingButton = new QToolButton;
+    cancelLoadingButton->setDefaultAction(cancelLoadingAct);
+    cancelLoadingButton->setVisible(false);
+    statusBar()->addPermanentWidget(cancelLoadingButton);
+
+    renderStatsLabel = new QLabel;
+    renderStatsLabel->setVisible(false);
+    statusBar()->addPermanentWidget(renderStatsLabel);
+
+    repaintScheduler = new RepaintScheduler(this);
+    slicePrefetcher = new SlicePrefetcher(&sliceCache, this);
+    editLog = new EditLog(this);
+    repaintScheduler->setFrameRate(QGuiApplication::primaryScreen()->refreshRate());
+    connect(repaintScheduler, &RepaintScheduler::render, this, [this](const QRegion &region) {
+        for (const QRect &rect : region) { updateDisplay(rect); }
+        updateRenderStats();
+        updateLesionStats();
+    });
+
     resize(QGuiApplication::primaryScreen()->availableSize() * 3 / 5);
 }
 
 AnnotationManager::~AnnotationManager() {
-    if (imageHeight != 0 && imageWidth != 0 && slicesNo != 0) {  // check if any file was ever loaded
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] stirData[i][j];
-            }
-            delete[] stirData[i];
-        }
-        delete[] stirData;
-
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] spData[i][j];
-            }
-            delete[] spData[i];
-        }
-        delete[] spData;
-
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] spAnnotationData[i][j];
-            }
-            delete[] spAnnotationData[i];
-        }
-        delete[] spAnnotationData;
-
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] manualCorrectionsData[i][j];
-            }
-            delete[] manualCorrectionsData[i];
-        }
-        delete[] manualCorrectionsData;
-
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] gridData[i][j];
-            }
-            delete[] gridData[i];
-        }
-        delete[] gridData;
-    }
-    removeComparisonFiles();
+    slicePrefetcher->cancel(); // its workers read the volumes
 }
 
 void AnnotationManager::createActions() {
@@ -112,9 +119,16 @@ void AnnotationManager::createActions() {
     saveAct->setShortcut(QKeySequence::Save);
     saveAct->setEnabled(false);
 
+    saveCombinedAct = fileMenu->addAction(tr("Save co&mbined annotations too"));
+    saveCombinedAct->setCheckable(true);
+
     closeImgAct = fileMenu->addAction(tr("&Close image"), this, &AnnotationManager::closeImg);
     closeImgAct->setEnabled(false);
 
+    cancelLoadingAct = fileMenu->addAction(tr("C&ancel loading"), this, &AnnotationManager::cancelLoading);
+    cancelLoadingAct->setShortcut(Qt::Key_Escape);
+    cancelLoadingAct->setEnabled(false);
+
     fileMenu->addSeparator();
 
     QMenu *segMethodMenu = fileMenu->addMenu(tr("&Segmentation method"));
@@ -172,7 +186,14 @@ void AnnotationManager::createActions() {
 
     QMenu *editMenu = menuBar()->addMenu(tr("&Edit"));
 
-    // TODO Add undo and redo action
+    undoAct = editMenu->addAction(tr("&Undo"), this, &AnnotationManager::undo);
+    undoAct->setShortcut(QKeySequence::Undo);
+    undoAct->setEnabled(false);
+
+    redoAct = editMenu->addAction(tr("Re&do"), this, &AnnotationManager::redo);
+    redoAct->setShortcut(QKeySequence::Redo);
+    redoAct->setEnabled(false);
+
     resetAnnotationsAct = editMenu->addAction(tr("&Reset all annotations for current slice"), this, &AnnotationManager::resetAnnotations);
     resetAnnotationsAct->setEnabled(false);
 
@@ -188,6 +209,11 @@ void AnnotationManager::createActions() {
     reduceManualPenSizeAct->setShortcut(Qt::Key_B);
     reduceManualPenSizeAct->setEnabled(false);
 
+    fillRegionAct = editMenu->addAction(tr("&Fill enclosed regions"));
+    fillRegionAct->setShortcut(Qt::Key_I);
+    fillRegionAct->setCheckable(true);
+    fillRegionAct->setEnabled(false);
+
     QMenu *viewMenu = menuBar()->addMenu(tr("&View"));
 
     zoomInAct = viewMenu->addAction(tr("Zoom &In (25%)"), this, &AnnotationManager::zoomIn);
@@ -202,6 +228,9 @@ void AnnotationManager::createActions() {
     normalSizeAct->setShortcut(tr("Ctrl+0"));
     normalSizeAct->setEnabled(false);
 
+    smoothZoomAct = viewMenu->addAction(tr("&Smooth zoom"), this, &AnnotationManager::changeSmoothZoom);
+    smoothZoomAct->setCheckable(true);
+
     viewMenu->addSeparator();
 
     nextSliceAct = viewMenu->addAction(tr("&Next slice"), this, &AnnotationManager::nextSlice);
@@ -224,6 +253,16 @@ void AnnotationManager::createActions() {
     displayFrameAct->setShortcut(Qt::Key_F);
     displayFrameAct->setEnabled(false);
 
+    displayRenderStatsAct = viewMenu->addAction(tr("Display &rendering statistics"), this, &AnnotationManager::changeDisplayRenderStats);
+    displayRenderStatsAct->setCheckable(true);
+
+    renderCacheSizeAct = viewMenu->addAction(tr("Rendering &cache size..."), this, &AnnotationManager::setRenderCacheSize);
+
+    QAction *displayLesionStatsAct = lesionStatsDock->toggleViewAction();
+    displayLesionStatsAct->setText(tr("Display &lesion statistics"));
+    displayLesionStatsAct->setShortcut(Qt::Key_L);
+    viewMenu->addAction(displayLesionStatsAct);
+
     viewMenu->addSeparator();
 
     nextComparisonImageAct = viewMenu->addAction(tr("Next &comparison image"), this, &AnnotationManager::nextComparisonImage);
@@ -242,10 +281,12 @@ void AnnotationManager::updateActions() {
     closeImgAct->setEnabled(filesLoaded);
     normalSizeAct->setEnabled(filesLoaded);
     resetAnnotationsAct->setEnabled(filesLoaded);
+    updateUndoActions();
     if (segmentationMethod != "MANUAL") {changeAnnotationsModeAct->setEnabled(filesLoaded);}
     else {changeAnnotationsModeAct->setEnabled(false);}
     increaseManualPenSizeAct->setEnabled(manualCorrectionsMode);
     reduceManualPenSizeAct->setEnabled(manualCorrectionsMode);
+    fillRegionAct->setEnabled(manualCorrectionsMode);
     zoomInAct->setEnabled(filesLoaded);
     zoomOutAct->setEnabled(filesLoaded);
     nextSliceAct->setEnabled(filesLoaded);
@@ -253,7 +294,7 @@ void AnnotationManager::updateActions() {
     displayGridAct->setEnabled(filesLoaded);
     displayAnnotationsAct->setEnabled(filesLoaded);
     displayFrameAct->setEnabled(!frameData.isEmpty());
-    nextComparisonImageAct->setEnabled(!comparisonData.isEmpty());
+    nextComparisonImageAct->setEnabled(!comparisonData.empty());
 
     if(filesLoaded) {
         if (imageType == "SPA"){
@@ -274,10 +315,17 @@ void AnnotationManager::updateActions() {
 void AnnotationManager::mousePressEvent(QMouseEvent *event) {
     if (loadedFileName == ""){return;}
     //position relative to scrollArea beginning, regardless current scrollbars position
-    QPoint position =  mapToGlobal(event->pos()) - mapToGlobal(imageLabel->pos()) - splitter->pos();
+    QPoint position =  mapToGlobal(event->pos()) - mapToGlobal(imageView->pos()) - splitter->pos();
     position.setX(static_cast<int>(position.x()/scaleFactor));
     position.setY(static_cast<int>(position.y()/scaleFactor));
-    if (event->buttons() == Qt::LeftButton) {
+    if (manualCorrectionsMode && fillRegionAct->isChecked()) {
+        // a single fill per click, nothing to drag
+        if (event->buttons() == Qt::LeftButton) {
+            fillRegion(position, true);
+        } else if (event->buttons() == Qt::RightButton) {
+            fillRegion(position, false);
+        }
+    } else if (event->buttons() == Qt::LeftButton) {
         clickedLeft = true;
         if (manualCorrectionsMode) {
             lastManualPoint = position;
@@ -307,7 +355,7 @@ void AnnotationManager::mousePressEvent(QMouseEvent *event) {
 void AnnotationManager::mouseMoveEvent(QMouseEvent *event) {
     if (loadedFileName == ""){return;}
     //position relative to scrollArea beginning, regardless current scrollbars position
-    QPoint position =  mapToGlobal(event->pos()) - mapToGlobal(imageLabel->pos()) - splitter->pos();
+    QPoint position =  mapToGlobal(event->pos()) - mapToGlobal(imageView->pos()) - splitter->pos();
     position.setX(static_cast<int>(position.x()/scaleFactor));
     position.setY(static_cast<int>(position.y()/scaleFactor));
     if ((event->buttons() & Qt::LeftButton) && clickedLeft) {
@@ -336,7 +384,7 @@ void AnnotationManager::mouseMoveEvent(QMouseEvent *event) {
 void AnnotationManager::mouseReleaseEvent(QMouseEvent *event) {
     if (loadedFileName == ""){return;}
     //position relative to scrollArea beginning, regardless current scrollbars position
-    QPoint position =  mapToGlobal(event->pos()) - mapToGlobal(imageLabel->pos()) - splitter->pos();
+    QPoint position =  mapToGlobal(event->pos()) - mapToGlobal(imageView->pos()) - splitter->pos();
     position.setX(static_cast<int>(position.x()/scaleFactor));
     position.setY(static_cast<int>(position.y()/scaleFactor));
     if ((event->buttons() == Qt::LeftButton) && clickedLeft) {
@@ -362,52 +410,126 @@ void AnnotationManager::mouseReleaseEvent(QMouseEvent *event) {
             }
         }
     }
+    // everything from pressing the button to releasing it is undone at once, the edit log got it span by span
+    journal.commit();
+    updateUndoActions();
 }
 
-void AnnotationManager::manualCorrectionLine(QPoint &endPoint, const bool &adding) { //Bresenham's line algorithm
-    int x0 = endPoint.x();
-    int y0 = endPoint.y();
-    int x1 = lastManualPoint.x();
-    int y1 = lastManualPoint.y();
+void AnnotationManager::manualCorrectionLine(QPoint &endPoint, const bool &adding) {
+    // Discs with radius manualPenSize along the line from the last point, merged into one span per row
+    const BrushStroke stroke(endPoint, lastManualPoint, manualPenSize);
+    const QRect imageRect(0, 0, imageWidth, imageHeight);
+    stroke.forEachSpan(imageRect, [this, adding](int y, int left, int right) { markSpan(y, left, right, adding); });
 
-    int dx =  abs(x1-x0), sx = x0<x1 ? 1 : -1;
-    int dy = -abs(y1-y0), sy = y0<y1 ? 1 : -1;
-    int err = dx+dy, err2; // error value e_xy, 2*e_xy
+    manualDirtySlices[currSlice] = 1;
+    repaintScheduler->schedule(stroke.boundingRect().intersected(imageRect));
+    lastManualPoint = endPoint;
+    unsavedChanges = true;
+}
 
-    while (true) {
-        // Iterating over pixels inside circle with radius manualPenSize and center in (x0,y0)
-        for (int yw = -manualPenSize; yw <= manualPenSize; yw++) {
-            int dxw = static_cast<int> (sqrt(manualPenSize * manualPenSize - yw * yw));
-            for (int xw = -dxw; xw <= dxw; xw++)
-                markPixel(x0+xw, y0+yw, adding);
+void AnnotationManager::markSpan(int y, int left, int right, const bool &adding) {
+    char *corrections = manualCorrectionsData.row(currSlice, y);
+    const BitVolume::Word *spRow = spAnnotationData.row(currSlice, y);
+    EditJournal::Step &step = journal.pending();
+    bool changed = false;
+    for (int x = left; x <= right; x++) {
+        const bool inSpAnnotation = (spRow[x / BitVolume::wordBits] >> (x % BitVolume::wordBits)) & 1u;
+        char correction;
+        if (adding) { // Adding new pixels to annotation
+            correction = inSpAnnotation ? 0 : 1;
+        } else { // Removing pixels from annotation
+            correction = inSpAnnotation ? -1 : 0;
         }
-        updateDisplay();
-        if (x0==x1 && y0==y1) break;
-        err2 = 2 * err;
-        if (err2 >= dy) { err += dy; x0 += sx; } // e_xy+e_x > 0
-        if (err2 <= dx) { err += dx; y0 += sy; } // e_xy+e_y < 0
+        if (corrections[x] != correction) {
+            step.changeCorrection(currSlice, y, x, corrections[x], correction);
+            corrections[x] = correction;
+            changed = true;
+        }
+    }
+    if (changed) {
+        updateCombined(currSlice, y, left / BitVolume::wordBits, right / BitVolume::wordBits);
+        logSpan(EditLog::Corrections, currSlice, y, left, right);
     }
+}
 
-    lastManualPoint = endPoint;
-    unsavedChanges = true;
+void AnnotationManager::updateCombined(int slice, int y, int firstWord, int lastWord) {
+    lesionStats->add(slice, combineAnnotations(spAnnotationData, manualCorrectionsData, combinedData,
+                                               slice, y, firstWord, lastWord));
 }
 
-void AnnotationManager::markPixel(const int &x, const int &y, const bool &adding) {
-    if (x<0 || x>imageWidth-1 || y<0 || y>imageHeight-1) {return;}
+int AnnotationManager::combineAnnotations(const BitVolume &spAnnotation, const Volume<char> &corrections,
+                                          BitVolume &combined, int slice, int y, int firstWord, int lastWord) {
+    const BitVolume::Word *spRow = spAnnotation.row(slice, y);
+    const auto *correctionsRow = reinterpret_cast<const unsigned char *>(corrections.row(slice, y));
+    BitVolume::Word *combinedRow = combined.row(slice, y);
+    int setVoxels = 0;
+    for (int w = firstWord; w <= lastWord; w++) {
+        const int remaining = combined.width() - w * BitVolume::wordBits;
+        BitVolume::Word additions;
+        BitVolume::Word removals;
+        packCorrections8(correctionsRow + w * BitVolume::wordBits, &additions, &removals,
+                         remaining < BitVolume::wordBits ? remaining : BitVolume::wordBits);
+        const BitVolume::Word combinedWord = (spRow[w] & ~removals) | additions;
+        setVoxels += BitVolume::popcount(combinedWord) - BitVolume::popcount(combinedRow[w]);
+        combinedRow[w] = combinedWord;
+    }
+    return setVoxels;
+}
 
-    if (adding) { // Adding new pixels to annotation
-        if (!spAnnotationData[currSlice][x][y]) {
-            manualCorrectionsData[currSlice][x][y] = 1;
-        } else {
-            manualCorrectionsData[currSlice][x][y] = 0;
-        }
-    } else { // Removing pixels from annotation
-        if (spAnnotationData[currSlice][x][y]) {
-            manualCorrectionsData[currSlice][x][y] = -1;
-        } else {
-            manualCorrectionsData[currSlice][x][y] = 0;
+void AnnotationManager::fillRegion(const QPoint &position, const bool &adding) {
+    auto annotated = [this](int x, int y) {
+        const char correction = manualCorrectionsData(currSlice, x, y);
+        return correction == 1 || (correction == 0 && spAnnotationData.test(currSlice, x, y));
+    };
+    // Adding fills the background enclosed by the annotation, removing clears the annotated region
+    const std::vector<FloodFill::Span> &spans =
+            adding ? floodFill.fill(imageWidth, imageHeight, position, [&](int x, int y) { return !annotated(x, y); })
+                   : floodFill.fill(imageWidth, imageHeight, position, annotated);
+    if (spans.empty()) { return; }
+    if (adding && floodFill.reachedEdge()) {
+        statusBar()->showMessage(tr("The region is not enclosed by the annotation."), 3000);
+        return;
+    }
+
+    for (const FloodFill::Span &span : spans) { markSpan(span.y, span.left, span.right, adding); }
+    manualDirtySlices[currSlice] = 1;
+    repaintScheduler->schedule(floodFill.boundingRect());
+    unsavedChanges = true;
+}
+
+int AnnotationManager::annotateSpan(int slice, int y, int left, int right, const bool &adding) {
+    BitVolume::Word *annotationRow = spAnnotationData.row(slice, y);
+    char *corrections = manualCorrectionsData.row(slice, y);
+    EditJournal::Step &step = journal.pending();
+    // Corrections inside the span that agree with the new annotation are not needed anymore
+    const char redundantCorrection = adding ? 1 : -1;
+    int changedPixels = 0;
+    bool correctionsCleared = false;
+
+    for (int w = left / BitVolume::wordBits; w <= right / BitVolume::wordBits; w++) {
+        const BitVolume::Word spanBits = BitVolume::bitRange(std::max(0, left - w * BitVolume::wordBits),
+                                                             std::min(BitVolume::wordBits - 1, right - w * BitVolume::wordBits));
+        BitVolume::Word changed = spanBits & (adding ? ~annotationRow[w] : annotationRow[w]);
+        annotationRow[w] ^= changed;
+        step.flipWord(slice, y, w, changed);
+        changedPixels += BitVolume::popcount(changed);
+        for (; changed != 0; changed &= changed - 1) {
+            const int x = w * BitVolume::wordBits + BitVolume::lowestBit(changed);
+            if (corrections[x] == redundantCorrection) {
+                step.changeCorrection(slice, y, x, redundantCorrection, 0);
+                corrections[x] = 0;
+                manualDirtySlices[slice] = 1;
+                correctionsCleared = true;
+            }
         }
     }
+    if (changedPixels > 0) {
+        spDirtySlices[slice] = 1;
+        updateCombined(slice, y, left / BitVolume::wordBits, right / BitVolume::wordBits);
+        logSpan(EditLog::SpAnnotation, slice, y, left, right);
+    }
+    if (correctionsCleared) { logSpan(EditLog::Corrections, slice, y, left, right); }
+    return changedPixels;
 }
 
 void AnnotationManager::markSuperPixel(const QPoint &position, const bool &adding) {
@@ -416,51 +538,31 @@ void AnnotationManager::markSuperPixel(const QPoint &position, const bool &addin
 
     if (x < 0 || x > imageWidth - 1 || y < 0 || y > imageHeight - 1) { return; }
 
-    unsigned short chosenColor = spData[currSlice][x][y];
-
-    std::queue<std::pair<int, int>> pointsQueue;
-    pointsQueue.emplace(x, y);
-
-    std::pair<int, int> currPoint;
-    int currX;
-    int currY;
-
-    while (!pointsQueue.empty()) {
-        currPoint = pointsQueue.front();
-        pointsQueue.pop();
-        currX = currPoint.first;
-        currY = currPoint.second;
-
-        // Going through chosen point and it's neighbours (if it's inside image area)
-        for (int i = -1; i <= 1; i++)
-            for (int j = -1; j <= 1; j++) {
-                if (currX + i >= 0 && currX + i < imageWidth && currY + j >= 0 && currY + j < imageHeight) {
-                    if (spData[currSlice][currX + i][currY + j] == chosenColor) {
-                        if (adding) { // Adding new super pixels to annotation
-                            if (spAnnotationData[currSlice][currX + i][currY + j] == 0) {
-                                pointsQueue.emplace(currX + i, currY + j);
-                                spAnnotationData[currSlice][currX + i][currY + j] = 1;
-                                if (manualCorrectionsData[currSlice][currX + i][currY + j] == 1) {
-                                    manualCorrectionsData[currSlice][currX + i][currY + j] = 0;
-                                    // If there was correction in area of newly added superpixel it's removed
-                                }
-                            }
-                        } else { // Removing superpixels from annotation
-                            if (spAnnotationData[currSlice][currX + i][currY + j]) {
-                                pointsQueue.emplace(currX + i, currY + j);
-                                spAnnotationData[currSlice][currX + i][currY + j] = 0;
-                                if (manualCorrectionsData[currSlice][currX + i][currY + j] == -1) {
-                                    manualCorrectionsData[currSlice][currX + i][currY + j] = 0;
-                                    // If there was correction in area of newly removed superpixel it's removed
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    // Dragging over a superpixel already (un)marked costs a single lookup
+    const int region = spIndex.regionAt(currSlice, x, y);
+    RegionStates &states = spIndex.states(currSlice);
+    const RegionStates::State marking = adding ? RegionStates::Marked : RegionStates::Unmarked;
+    if (states.state(region) == marking) { return; }
+
+    const EditJournal::Step::Mark journalMark = journal.pending().mark();
+    int regionPixels = 0;
+    int changedPixels = 0;
+    QRect touched; // pixels of the current slice that changed
+    for (auto span = spIndex.spansBegin(currSlice, region); span != spIndex.spansEnd(currSlice, region); span++) {
+        regionPixels += span->right - span->left + 1;
+        const int spanChanged = annotateSpan(currSlice, span->y, span->left, span->right, adding);
+        if (spanChanged > 0) {
+            changedPixels += spanChanged;
+            touched |= QRect(QPoint(span->left, span->y), QPoint(span->right, span->y));
+        }
+    }
+    states.setState(region, marking);
+    if (changedPixels == regionPixels) { journal.pending().flipRegion(journalMark, currSlice, region); }
+
+    if (!touched.isEmpty()) {
+        repaintScheduler->schedule(touched);
+        unsavedChanges = true;
     }
-    updateDisplay();
-    unsavedChanges = true;
 }
 
 void AnnotationManager::markSuperVoxel(const QPoint &position, const bool &adding) {
@@ -469,108 +571,85 @@ void AnnotationManager::markSuperVoxel(const QPoint &position, const bool &addin
 
     if (x < 0 || x > imageWidth - 1 || y < 0 || y > imageHeight - 1) { return; }
 
-    unsigned short chosenColor = spData[currSlice][x][y];
-
-    std::queue<std::pair<int, int>> pointsQueue;
-    pointsQueue.emplace(x, y);
-
-    std::pair<int, int> currPoint;
-    int currX;
-    int currY;
-
-    while (!pointsQueue.empty()) {
-        currPoint = pointsQueue.front();
-        pointsQueue.pop();
-        currX = currPoint.first;
-        currY = currPoint.second;
-
-        // Going through chosen point and it's neighbours (if it's inside image area)
-        for (int i = -1; i <= 1; i++)
-            for (int j = -1; j <= 1; j++) {
-                if (currX + i >= 0 && currX + i < imageWidth && currY + j >= 0 && currY + j < imageHeight) {
-                    for (int slice=0; slice<slicesNo; slice++) {
-                        if (spData[slice][currX + i][currY + j] == chosenColor) {
-                            if (adding) { // Adding new supervoxel to annotation
-                                if (spAnnotationData[slice][currX + i][currY + j] == 0) {
-                                    pointsQueue.emplace(currX + i, currY + j);
-                                    spAnnotationData[slice][currX + i][currY + j] = 1;
-                                    if (manualCorrectionsData[slice][currX + i][currY + j] == 1) {
-                                        manualCorrectionsData[slice][currX + i][currY + j] = 0;
-                                        // If there was correction in area of newly added superpixel it's removed
-                                    }
-                                }
-                            } else { // Removing supervoxel from annotation
-                                if (spAnnotationData[slice][currX + i][currY + j]) {
-                                    pointsQueue.emplace(currX + i, currY + j);
-                                    spAnnotationData[slice][currX + i][currY + j] = 0;
-                                    if (manualCorrectionsData[slice][currX + i][currY + j] == -1) {
-                                        manualCorrectionsData[slice][currX + i][currY + j] = 0;
-                                        // If there was correction in area of newly removed superpixel it's removed
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    // Dragging over a supervoxel already (un)marked costs a single lookup
+    const unsigned short label = spData(currSlice, x, y);
+    RegionStates &states = svIndex.states();
+    const RegionStates::State marking = adding ? RegionStates::Marked : RegionStates::Unmarked;
+    if (states.state(label) == marking) { return; }
+
+    // All voxels of the label, on every slice, whether connected through the current slice or not
+    const EditJournal::Step::Mark journalMark = journal.pending().mark();
+    int regionPixels = 0;
+    int changedPixels = 0;
+    QRect touched; // pixels of the current slice that changed
+    for (auto span = svIndex.spansBegin(label); span != svIndex.spansEnd(label); span++) {
+        regionPixels += span->right - span->left + 1;
+        const int spanChanged = annotateSpan(span->slice, span->y, span->left, span->right, adding);
+        if (spanChanged > 0) {
+            changedPixels += spanChanged;
+            if (span->slice == currSlice) { touched |= QRect(QPoint(span->left, span->y), QPoint(span->right, span->y)); }
+        }
+    }
+    states.setState(label, marking);
+    if (changedPixels == regionPixels) { journal.pending().flipRegion(journalMark, -1, label); }
+
+    if (changedPixels > 0) {
+        if (!touched.isEmpty()) { repaintScheduler->schedule(touched); }
+        unsavedChanges = true;
     }
-    updateDisplay();
-    unsavedChanges = true;
 }
 
 bool AnnotationManager::loadFiles(const QString &fileName){
+    stopLoading();
+
     QDir fileDir(fileName);
     QFileInfo fileInfo(fileName);
     QStringList imgParams=fileInfo.fileName().split("_");
 
     imageType = imgParams[imgParams.size()-7];
     patientNo = imgParams[imgParams.size()-6].toInt();
-    imageWidth = imgParams[imgParams.size()-5].toInt();
-    imageHeight = imgParams[imgParams.size()-4].toInt();
-    slicesNo = imgParams[imgParams.size()-3].toInt();
-
-    stirData = new unsigned short **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        stirData[i] = new unsigned short *[imageWidth];
-
-        for (int j = 0; j < imageWidth; j++)
-            stirData[i][j] = new unsigned short [imageHeight];
-    }
-
-    spData = new unsigned short **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        spData[i] = new unsigned short *[imageWidth];
-
-        for (int j = 0; j < imageWidth; j++)
-            spData[i][j] = new unsigned short [imageHeight];
-    }
-
-    spAnnotationData = new char **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        spAnnotationData[i] = new char *[imageWidth];
 
-        for (int j = 0; j < imageWidth; j++)
-            spAnnotationData[i][j] = new char [imageHeight];
-    }
-
-    manualCorrectionsData = new char **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        manualCorrectionsData[i] = new char *[imageWidth];
-
-        for (int j = 0; j < imageWidth; j++)
-            manualCorrectionsData[i][j] = new char [imageHeight];
+    VolumeInfo imageInfo;
+    if (!readVolumeInfo(fileName, volumeInfoFromFileName(fileName), imageInfo)
+        || imageInfo.dataType != VolumeInfo::UInt16 || imageInfo.slices == 0) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("Cannot load image data! Please make sure the file is complete."));
+        return false;
     }
+    slicePrefetcher->cancel();
+    imageWidth = imageInfo.width;
+    imageHeight = imageInfo.height;
+    slicesNo = imageInfo.slices;
+    voxelVolume = imageInfo.hasSpacing() ? imageInfo.spacing[0] * imageInfo.spacing[1] * imageInfo.spacing[2] : 0;
 
-    gridData = new bool **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        gridData[i] = new bool *[imageWidth];
-
-        for (int j = 0; j < imageWidth; j++)
-            gridData[i][j] = new bool [imageHeight];
-    }
+    // the previous image is dropped right away, the new volumes are moved in as the workers finish them
+    loadedFileName = "";
+    stirData.clear();
+    spData.clear();
+    spIndex.clear();
+    svIndex.clear();
+    journal.clear();
+    editLog->close();
+    spAnnotationData = BitVolume();
+    combinedData = BitVolume();
+    lesionStats->reset();
+    manualCorrectionsData.clear();
+    spDirtySlices.assign(slicesNo, 1);
+    manualDirtySlices.assign(slicesNo, 1);
+    spSpans.assign(slicesNo, SliceSpans());
+    manualSpans.assign(slicesNo, SliceSpans());
+    combinedDirtySlices.assign(slicesNo, 1);
+    combinedSpans.assign(slicesNo, SliceSpans());
+    gridData.close();
+    removeComparisonFiles();
+    sliceCache.clear();
+    repaintScheduler->discard();
+    imageView->setImage(QImage());
+    scrollArea->setVisible(false);
+    comparisonScrollArea->setVisible(false);
+    updateActions();
 
-    loadRaw(fileName, stirData);
-    rescaleData(stirData);
+    QString spFileName;
 
     if (segmentationMethod != "MANUAL") {
         QString spNumberVal;
@@ -592,9 +671,10 @@ bool AnnotationManager::loadFiles(const QString &fileName){
             return false;
         }
 
-        if (!loadRaw(fileDir.path() + QString(QDir::separator()) + QString("%0SuperPixel%1_%2_%3_%4_%5_2_.raw")
-                             .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo),
-                     spData)) {
+        spFileName = fileDir.path() + QString(QDir::separator()) + QString("%0SuperPixel%1_%2_%3_%4_%5_2_.raw")
+                .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
+
+        if (!QFileInfo::exists(spFileName)) {
             QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                      tr("Cannot find segmentation data! "
                                         "Please make sure it is available and load the file again."));
@@ -608,9 +688,9 @@ bool AnnotationManager::loadFiles(const QString &fileName){
             return false;
         }
 
-        if (!loadRaw(fileDir.path() + QString(QDir::separator()) + QString("%0BorderSuperPixel%1_%2_%3_%4_%5_2_.raw")
+        if (!gridData.open(fileDir.path() + QString(QDir::separator()) + QString("%0BorderSuperPixel%1_%2_%3_%4_%5_2_.raw")
                              .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo),
-                     gridData)) {
+                           imageWidth, imageHeight, slicesNo)) {
             QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                      tr("Cannot find grid data! "
                                         "Please make sure it is available and load the file again."));
@@ -641,16 +721,6 @@ bool AnnotationManager::loadFiles(const QString &fileName){
         spAnnFileName = fileDir.path() + QString(QDir::separator()) + QString("%0spAnnotations%1_%2_%3_%4_%5_1_.raw")
                 .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
 
-        if (QFileInfo::exists(spAnnFileName)) {
-            loadRaw(spAnnFileName, spAnnotationData);
-        } else {
-            for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-                for (int y = 0; y < imageHeight; y++)
-                    for (int x = 0; x < imageWidth; x++) {
-                        spAnnotationData[sl_no][x][y] = 0;
-                    }
-        }
-
         fileDir.cd("../../manual/" + imageType + spNumberVal + segmentationMethod);
 
         manualCorrFileName =
@@ -658,15 +728,12 @@ bool AnnotationManager::loadFiles(const QString &fileName){
                         .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(
                         slicesNo);
 
-        if (QFileInfo::exists(manualCorrFileName)) {
-            loadRaw(manualCorrFileName, manualCorrectionsData);
-        } else {
-            for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-                for (int y = 0; y < imageHeight; y++)
-                    for (int x = 0; x < imageWidth; x++) {
-                        manualCorrectionsData[sl_no][x][y] = 0;
-                    }
-        }
+        // created on the first save of the combined annotations
+        combinedAnnFileName =
+                QDir::cleanPath(fileDir.path() + "/../../combined/" + imageType + spNumberVal + segmentationMethod)
+                + QString(QDir::separator()) + QString("%0combinedAnnotations%1_%2_%3_%4_%5_1_.raw")
+                        .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(
+                        slicesNo);
     } else {
         fileDir.cd("../../");
         if (!fileDir.mkpath("annotations/manual/" + imageType + "MANUAL")) {
@@ -680,120 +747,176 @@ bool AnnotationManager::loadFiles(const QString &fileName){
                 fileDir.path() + QString(QDir::separator()) + QString("0manualAnnotationsMANUAL_%1_%2_%3_%4_1_.raw")
                         .arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
 
-        if (QFileInfo::exists(manualCorrFileName)) {
-            loadRaw(manualCorrFileName, manualCorrectionsData);
-        } else {
-            for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-                for (int y = 0; y < imageHeight; y++)
-                    for (int x = 0; x < imageWidth; x++) {
-                        manualCorrectionsData[sl_no][x][y] = 0;
-                    }
-        }
-
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    spAnnotationData[sl_no][x][y] = 0;
-                }
-
         manualCorrectionsMode = true;
     }
 
+    // Every volume is read by its own worker into loadJob, the GUI stays responsive meanwhile
+    loadJob = std::make_shared<LoadJob>();
+    loadJob->fileName = fileName;
     currSlice = 0;
     scaleFactor = 1.0;
-    loadedFileName = fileName;
-    setWindowFilePath(fileName);
-    updateActions();
-    updateDisplay();
 
-    return true;
-}
+    const int width = imageWidth;
+    const int height = imageHeight;
+    const int slices = slicesNo;
 
-bool AnnotationManager::loadRaw(const QString &fileName, unsigned short ***dataArray) const {
-    std::ifstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::ate | std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        std::streampos size;
-        char *memBlock;
-        size = imageFileStream.tellg();
-        memBlock = new char[size];
-
-        imageFileStream.seekg(0, std::ios::beg);
-        imageFileStream.read(memBlock, size);
-
-        int currByte = 0;
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    dataArray[sl_no][x][y] = 256 * static_cast<unsigned char>(memBlock[currByte])
-                                             + static_cast<unsigned char>(memBlock[currByte + 1]);
-                    currByte += 2;
-                }
-        delete[] memBlock;
-        imageFileStream.close();
+    startLoadTask([=](LoadJob &job) {
+        job.stirData = Volume<unsigned short>(width, height, slices);
+        return loadRawRescaled(fileName, job.stirData);
+    }, [this](bool loaded) {
+        if (!loaded) {
+            stopLoading();
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                     tr("Cannot load image data! Please make sure the file is complete."));
+            return;
+        }
+        stirData = std::move(loadJob->stirData);
+        updateDisplay(); // first slice is shown while the rest is still loading
+    });
+
+    if (!spFileName.isEmpty()) {
+        // SLIC supervoxels span the slices and are selected as whole labels
+        const bool indexSupervoxels = segmentationMethod == "SLIC";
+        startLoadTask([=](LoadJob &job) {
+            if (!mapRaw(spFileName, width, height, slices, job.spData)) { return false; }
+            if (indexSupervoxels) {
+                job.svIndex.build(job.spData);
+            } else {
+                job.spIndex.build(job.spData);
+            }
+            return true;
+        }, [this](bool loaded) {
+            if (!loaded) {
+                stopLoading();
+                QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                         tr("Cannot find segmentation data! "
+                                            "Please make sure it is available and load the file again."));
+                return;
+            }
+            spData = std::move(loadJob->spData);
+            spIndex = std::move(loadJob->spIndex);
+            svIndex = std::move(loadJob->svIndex);
+        });
     }
 
+    const QString spAnnotationFileName = spFileName.isEmpty() ? QString() : spAnnFileName;
+    const QString manualFileName = manualCorrFileName;
+    const QString logFileName = EditLog::logFileName(manualCorrFileName);
+    EditLog *log = editLog;
+    startLoadTask([=](LoadJob &job) {
+        job.spAnnotationData = BitVolume(width, height, slices);
+        // nothing to load for images annotated for the first time, but annotations which cannot be read
+        // must not be overwritten by the next save
+        if (!spAnnotationFileName.isEmpty() && annotationExists(spAnnotationFileName)
+            && !loadAnnotation(spAnnotationFileName, job.spAnnotationData)) {
+            return false;
+        }
+        if (!annotationExists(manualFileName)) {
+            job.manualCorrectionsData = Volume<char>(width, height, slices);
+        } else if (!loadCorrections(manualFileName, width, height, slices, job.manualCorrectionsData)) {
+            return false;
+        }
+        // edits not saved before the application was closed last time
+        job.recoveredEdits = log->replay(logFileName, job.spAnnotationData, job.manualCorrectionsData);
+        job.combinedData = BitVolume(width, height, slices);
+        for (int sl_no = 0; sl_no < slices; sl_no++) {
+            for (int y = 0; y < height; y++) {
+                combineAnnotations(job.spAnnotationData, job.manualCorrectionsData, job.combinedData,
+                                   sl_no, y, 0, job.combinedData.wordsPerRow() - 1);
+            }
+        }
+        return true;
+    }, [this](bool loaded) {
+        if (!loaded) {
+            stopLoading();
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                     tr("Cannot read the saved annotations of this image! "
+                                        "They have been left untouched, please check the annotation files."));
+            return;
+        }
+        spAnnotationData = std::move(loadJob->spAnnotationData);
+        manualCorrectionsData = std::move(loadJob->manualCorrectionsData);
+        combinedData = std::move(loadJob->combinedData);
+        lesionStats->reset();
+    });
+
+    loadProgressBar->setRange(0, loadJob->pendingTasks);
+    loadProgressBar->setValue(0);
+    loadProgressBar->setVisible(true);
+    cancelLoadingButton->setVisible(true);
+    cancelLoadingAct->setEnabled(true);
+    statusBar()->showMessage(tr("Loading %0...").arg(fileInfo.fileName()));
+
     return true;
 }
 
-bool AnnotationManager::loadRaw(const QString &fileName, char ***dataArray) const {
-    std::ifstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::ate | std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        std::streampos size;
-        char *memBlock;
-        size = imageFileStream.tellg();
-        memBlock = new char[size];
-
-        imageFileStream.seekg(0, std::ios::beg);
-        imageFileStream.read(memBlock, size);
-
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    dataArray[sl_no][x][y] = memBlock[sl_no * imageHeight * imageWidth + y * imageWidth + x];
-                }
-        delete[] memBlock;
-        imageFileStream.close();
+void AnnotationManager::startLoadTask(const std::function<bool(LoadJob &)> &task,
+                                      const std::function<void(bool)> &finished) {
+    const std::shared_ptr<LoadJob> job = loadJob;
+    job->pendingTasks++;
+
+    auto *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, job, finished]() {
+        watcher->deleteLater();
+        if (job != loadJob) { return; } // canceled or replaced by another file
+        loadProgressBar->setValue(loadProgressBar->value() + 1);
+        finished(watcher->result());
+        if (job == loadJob && --job->pendingTasks == 0) { finishLoading(); }
+    });
+    // the worker only ever touches the job, which stays alive until it is done
+    watcher->setFuture(QtConcurrent::run([job, task]() { return !job->canceled && task(*job); }));
+}
+
+void AnnotationManager::finishLoading() {
+    loadedFileName = loadJob->fileName;
+    const int recoveredEdits = loadJob->recoveredEdits;
+    loadJob.reset();
+
+    loadProgressBar->setVisible(false);
+    cancelLoadingButton->setVisible(false);
+    cancelLoadingAct->setEnabled(false);
+    statusBar()->clearMessage();
+
+    editLog->open(EditLog::logFileName(manualCorrFileName), imageWidth, imageHeight, slicesNo);
+    if (recoveredEdits > 0) {
+        unsavedChanges = true;
+        statusBar()->showMessage(tr("Unsaved changes from the previous session have been restored."));
     }
 
-    return true;
+    setWindowFilePath(loadedFileName);
+    updateActions();
+    updateDisplay();
 }
 
-bool AnnotationManager::loadRaw(const QString &fileName, bool ***dataArray) const {
-    std::ifstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::ate | std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        std::streampos size;
-        char *memBlock;
-        size = imageFileStream.tellg();
-        memBlock = new char[size];
-
-        imageFileStream.seekg(0, std::ios::beg);
-        imageFileStream.read(memBlock, size);
-
-        int currByte = 0;
-
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    dataArray[sl_no][x][y] = 256 * static_cast<unsigned char>(memBlock[currByte])
-                                             + static_cast<unsigned char>(memBlock[currByte + 1]) > 0;
-                    currByte += 2;
-                }
-        delete[] memBlock;
-        imageFileStream.close();
-    }
-    return true;
+void AnnotationManager::stopLoading() {
+    if (!loadJob) { return; }
+    loadJob->canceled = true;
+    loadJob.reset();
+
+    loadProgressBar->setVisible(false);
+    cancelLoadingButton->setVisible(false);
+    cancelLoadingAct->setEnabled(false);
+    statusBar()->clearMessage();
+
+    slicePrefetcher->cancel();
+    stirData.clear();
+    spData.clear();
+    spIndex.clear();
+    svIndex.clear();
+    journal.clear();
+    editLog->close();
+    gridData.close();
+    sliceCache.clear();
+    repaintScheduler->discard();
+    imageView->setImage(QImage());
+    scrollArea->setVisible(false);
+    updateActions();
+}
+
+void AnnotationManager::cancelLoading() {
+    if (!loadJob) { return; }
+    stopLoading();
+    statusBar()->showMessage(tr("Loading has been canceled."));
 }
 
 bool AnnotationManager::loadFrame(const QString &fileName) {
@@ -815,21 +938,14 @@ bool AnnotationManager::loadFrame(const QString &fileName) {
 }
 
 bool AnnotationManager::loadComparisonFile(const QString &fileName) {
-    auto ***currImageData = new unsigned short **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        currImageData[i] = new unsigned short *[imageWidth];
+    Volume<unsigned short> currImageData(imageWidth, imageHeight, slicesNo);
 
-        for (int j = 0; j < imageWidth; j++)
-            currImageData[i][j] = new unsigned short [imageHeight];
-    }
+    if (!loadRawRescaled(fileName, currImageData)) {return false;}
 
-    if (!loadRaw(fileName, currImageData)) {return false;}
+    slicePrefetcher->cancel(); // the comparison volumes may move
+    comparisonData.push_back(std::move(currImageData));
 
-    rescaleData(currImageData);
-
-    comparisonData.append(currImageData);
-
-    comparisonFileNo = comparisonData.size()-1;
+    comparisonFileNo = static_cast<int>(comparisonData.size()) - 1;
 
     updateActions();
     updateDisplay();
@@ -837,79 +953,77 @@ bool AnnotationManager::loadComparisonFile(const QString &fileName) {
     return true;
 }
 
-bool AnnotationManager::saveRaw(const QString &fileName, char ***dataArray) const {
-    std::ofstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    imageFileStream << dataArray[sl_no][x][y];
-                }
-        imageFileStream.close();
+void AnnotationManager::updateDisplay() {
+    repaintScheduler->discard(); // pending edits are part of the full redraw
+    QImage &display = imageView->image();
+    if (display.size() != QSize(imageWidth, imageHeight)) {
+        display = QImage(imageWidth, imageHeight, QImage::Format_ARGB32_Premultiplied);
     }
-    return true;
-}
-
-bool AnnotationManager::rescaleData(unsigned short ***dataArray) const {
-    unsigned short maxVal {1};
-    for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++)
-                if (maxVal < dataArray[sl_no][x][y]){ maxVal=dataArray[sl_no][x][y];}
+    renderRegion(display.rect());
 
-    for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++)
-                dataArray[sl_no][x][y] *= 65535 / maxVal;
-
-    return true;
-}
+    int horizontalScrollValue = scrollArea->horizontalScrollBar()->value();
+    int verticalScrollValue = scrollArea->verticalScrollBar()->value();
 
-void AnnotationManager::updateDisplay() {
-    QPixmap display(imageWidth, imageHeight);
-    QPainter painter(&display);
+    imageView->updateImageRect(display.rect());
+    scrollArea->setVisible(true);
+    imageView->adjustSize();
+    scrollArea->horizontalScrollBar()->setValue(horizontalScrollValue);
+    scrollArea->verticalScrollBar()->setValue(verticalScrollValue);
 
-    QImage stirImage (imageWidth, imageHeight, QImage::Format_RGBA64);
-    QImage gridImage (imageWidth, imageHeight, QImage::Format_RGBA64);
-    QImage annotationImage (imageWidth, imageHeight, QImage::Format_RGBA64);
+    if(comparisonFileNo > -1) {
+        comparisonImageView->setImage(comparisonLayer(currSlice, comparisonFileNo));
+        comparisonScrollArea->setVisible(true);
+        comparisonImageView->adjustSize();
+        comparisonScrollArea->horizontalScrollBar()->setValue(horizontalScrollValue);
+        comparisonScrollArea->verticalScrollBar()->setValue(verticalScrollValue);
+    } else {;
+        comparisonScrollArea->setVisible(false);
+    }
 
-    QRgba64 colorValue = {};
+    scaleImages(1);
+    updateRenderStats();
+    updateLesionStats();
+    prefetchSlices();
+}
 
-    for (int x = 0; x < imageWidth; x++)
-        for (int y = 0; y < imageHeight; y++) {
-            colorValue = qRgba64(stirData[currSlice][x][y], stirData[currSlice][x][y], stirData[currSlice][x][y], 65535);
-            stirImage.setPixelColor(x, y, colorValue);
-        }
-    painter.drawImage(QPoint(0,0), stirImage);
-
-    if(displayAnnotations) {
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++) {
-                if (spAnnotationData[currSlice][x][y] + manualCorrectionsData[currSlice][x][y] > 0) {
-                    colorValue = qRgba64(65535, 0, 0, 32767);
-                } else {
-                    colorValue = qRgba64(65535, 0, 0, 0);
-                }
-                annotationImage.setPixelColor(x, y, colorValue);
-            }
-        painter.drawImage(QPoint(0,0), annotationImage);
-    }
+void AnnotationManager::updateDisplay(const QRect &region) {
+    const QRect rect = region.intersected(imageView->image().rect());
+    if (rect.isEmpty()) { return; }
+    renderRegion(rect);
+    imageView->updateImageRect(rect);
+}
 
-    if(displayGrid) {
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++) {
-                if (gridData[currSlice][x][y]) {
-                    colorValue = qRgba64(0, 65535, 0, 65535);
-                } else {
-                    colorValue = qRgba64(0, 65535, 0, 0);
-                }
-                gridImage.setPixelColor(x, y, colorValue);
+void AnnotationManager::renderRegion(const QRect &region) {
+    QImage &display = imageView->image();
+
+    const quint32 annotationColor = qPremultiply(qRgba(255, 0, 0, 128));
+    const bool drawAnnotations = displayAnnotations && !manualCorrectionsData.isEmpty();
+    const bool drawGrid = displayGrid && gridData.isOpen();
+    const QImage base = baseLayer(currSlice);
+
+    // Columns are widened to whole mask words so the bit rows can be used as they are
+    const int firstWord = region.left() / BitVolume::wordBits;
+    const int regionLeft = firstWord * BitVolume::wordBits;
+    const int regionRight = std::min(imageWidth, (region.right() / BitVolume::wordBits + 1) * BitVolume::wordBits);
+    const int regionWidth = regionRight - regionLeft;
+    const int rowWords = (regionWidth + BitVolume::wordBits - 1) / BitVolume::wordBits;
+
+    std::vector<BitVolume::Word> annotationRow(rowWords);
+
+    // The annotations are tinted into the cached base row, except under the grid which is drawn over them
+    for (int y = region.top(); y <= region.bottom(); y++) {
+        auto *line = reinterpret_cast<quint32 *>(display.scanLine(y)) + regionLeft;
+        std::memcpy(line, reinterpret_cast<const quint32 *>(base.constScanLine(y)) + regionLeft,
+                    regionWidth * sizeof(quint32));
+
+        if (drawAnnotations) {
+            const BitVolume::Word *combinedRow = combinedData.row(currSlice, y) + firstWord;
+            const BitVolume::Word *gridRow = drawGrid ? gridData.row(currSlice, y) + firstWord : nullptr;
+            for (int w = 0; w < rowWords; w++) {
+                annotationRow[w] = gridRow != nullptr ? combinedRow[w] & ~gridRow[w] : combinedRow[w];
             }
-        painter.drawImage(QPoint(0,0), gridImage);
+            tintMaskRow(annotationRow.data(), annotationColor, line, regionWidth);
+        }
     }
 
     if(displayFrame) {
@@ -923,49 +1037,75 @@ void AnnotationManager::updateDisplay() {
                 int height = frameData[patientNo][currSlice][1].y() - frameData[patientNo][currSlice][0].y() + 2 * offset;
                 height = left_top_y + height < imageHeight ? height : imageHeight - left_top_y;
 
+                QPainter painter(&display);
+                painter.setClipRect(regionLeft, region.top(), regionWidth, region.height());
                 QPen pen(Qt::magenta, 2);
                 painter.setPen(pen);
                 painter.drawRect(left_top_x, left_top_y, width, height);
             }
         }
     }
+}
 
-    painter.end();
-
-    int horizontalScrollValue = scrollArea->horizontalScrollBar()->value();
-    int verticalScrollValue = scrollArea->verticalScrollBar()->value();
+QImage AnnotationManager::baseLayer(int slice) {
+    const bool drawGrid = displayGrid && gridData.isOpen();
+    const SliceCache::Key key {StirLayer, slice, drawGrid};
+    QImage base = sliceCache.find(key);
+    if (base.isNull()) {
+        base = renderBaseLayer(slice, drawGrid);
+        sliceCache.insert(key, base);
+    }
+    return base;
+}
 
-    imageLabel->setPixmap(display);
-    scrollArea->setVisible(true);
-    imageLabel->adjustSize();
-    scrollArea->horizontalScrollBar()->setValue(horizontalScrollValue);
-    scrollArea->verticalScrollBar()->setValue(verticalScrollValue);
+QImage AnnotationManager::comparisonLayer(int slice, int fileNo) {
+    const SliceCache::Key key {ComparisonLayer, slice, fileNo};
+    QImage comparison = sliceCache.find(key);
+    if (comparison.isNull()) {
+        comparison = renderComparisonLayer(slice, fileNo);
+        sliceCache.insert(key, comparison);
+    }
+    return comparison;
+}
 
-    if(comparisonFileNo > -1) {
-        QPixmap comparisonDisplay(imageWidth, imageHeight);
-        QPainter comparisonPainter(&comparisonDisplay);
-        QImage comparisonImage (imageWidth, imageHeight, QImage::Format_RGBA64);
-
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++) {
-                unsigned short val = comparisonData[comparisonFileNo][currSlice][x][y];
-                colorValue = qRgba64(val, val, val, 65535);
-                comparisonImage.setPixelColor(x, y, colorValue);
-            }
+QImage AnnotationManager::renderBaseLayer(int slice, bool drawGrid) {
+    const quint32 gridColor = qRgba(0, 255, 0, 255);
+    QImage base(imageWidth, imageHeight, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < imageHeight; y++) {
+        auto *line = reinterpret_cast<quint32 *>(base.scanLine(y));
+        renderGreyRow(stirData.row(slice, y), line, imageWidth);
+        if (drawGrid) { paintMaskRow(gridData.row(slice, y), gridColor, line, imageWidth); }
+    }
+    return base;
+}
 
-        comparisonPainter.drawImage(QPoint(0,0), comparisonImage);
-        comparisonPainter.end();
+QImage AnnotationManager::renderComparisonLayer(int slice, int fileNo) const {
+    QImage comparison(imageWidth, imageHeight, QImage::Format_ARGB32_Premultiplied);
+    const Volume<unsigned short> &comparisonVolume = comparisonData[fileNo];
+    for (int y = 0; y < imageHeight; y++) {
+        renderGreyRow(comparisonVolume.row(slice, y), reinterpret_cast<quint32 *>(comparison.scanLine(y)), imageWidth);
+    }
+    return comparison;
+}
 
-        comparisonImageLabel->setPixmap(comparisonDisplay);
-        comparisonScrollArea->setVisible(true);
-        comparisonImageLabel->adjustSize();
-        comparisonScrollArea->horizontalScrollBar()->setValue(horizontalScrollValue);
-        comparisonScrollArea->verticalScrollBar()->setValue(verticalScrollValue);
-    } else {;
-        comparisonScrollArea->setVisible(false);
+void AnnotationManager::prefetchSlices() {
+    if (stirData.isEmpty()) { return; }
+    const bool drawGrid = displayGrid && gridData.isOpen();
+    std::vector<SliceKey> layers {{StirLayer, 0, drawGrid}};
+    if (comparisonFileNo > -1) { layers.push_back({ComparisonLayer, 0, comparisonFileNo}); }
+
+    if (drawGrid) {
+        // grid slices are decoded here, the workers only read them
+        const int distance = slicePrefetcher->distance();
+        for (int sl_no = std::max(0, currSlice - distance); sl_no <= std::min(slicesNo - 1, currSlice + distance); sl_no++) {
+            gridData.decode(sl_no);
+        }
     }
 
-    scaleImages(1);
+    slicePrefetcher->prefetch(currSlice, slicesNo, layers, [this](const SliceKey &key) {
+        if (key.layer == ComparisonLayer) { return renderComparisonLayer(key.slice, key.variant); }
+        return renderBaseLayer(key.slice, key.variant != 0);
+    });
 }
 
 void AnnotationManager::open() {
@@ -992,7 +1132,6 @@ void AnnotationManager::open() {
 
     if (loaded) {
         lastFileDir = QFileInfo(dialog.selectedFiles().first()).absoluteDir();
-        loadedFileSize = QFileInfo(dialog.selectedFiles().first()).size();
     }
 }
 
@@ -1014,11 +1153,14 @@ void AnnotationManager::openComparisonImg() {
     bool loaded = false;
 
     while (dialog.exec() == QDialog::Accepted) {
-        if(QFileInfo(dialog.selectedFiles().first()).size() == loadedFileSize) {
-            loaded = loadComparisonFile(dialog.selectedFiles().first());
+        const QString comparisonFileName = dialog.selectedFiles().first();
+        VolumeInfo comparisonInfo;
+        if (readVolumeInfo(comparisonFileName, volumeInfoFromFileName(comparisonFileName), comparisonInfo)
+            && comparisonInfo.sameLayout(VolumeInfo(VolumeInfo::UInt16, imageWidth, imageHeight, slicesNo))) {
+            loaded = loadComparisonFile(comparisonFileName);
         } else {
             QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
-                                     tr("Chosen comparison image file size does not match the size of main image! "
+                                     tr("Chosen comparison image dimensions do not match the main image! "
                                         "Please try again."));
         }
         if(loaded) {break;}
@@ -1030,20 +1172,53 @@ void AnnotationManager::openComparisonImg() {
 }
 
 void AnnotationManager::save() {
+    // the combined annotation changes with either of the others, checked before their flags are reset
+    for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+        if (spDirtySlices[sl_no] || manualDirtySlices[sl_no]) { combinedDirtySlices[sl_no] = 1; }
+    }
     if (segmentationMethod != "MANUAL") {
-        if (!saveRaw(spAnnFileName, spAnnotationData)) {
+        for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+            if (spDirtySlices[sl_no]) {
+                encodeSpans(spAnnotationData, sl_no, spSpans[sl_no]);
+                spDirtySlices[sl_no] = 0;
+            }
+        }
+        if (!saveSpans(spanFileName(spAnnFileName), imageWidth, imageHeight, 1, spSpans)) {
             QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                      tr("Could not save annotations, please try again."));
             return;
         }
     }
-    if (!saveRaw(manualCorrFileName, manualCorrectionsData)) {
+    for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+        if (manualDirtySlices[sl_no]) {
+            encodeCorrectionSpans(manualCorrectionsData, sl_no, manualSpans[sl_no]);
+            manualDirtySlices[sl_no] = 0;
+        }
+    }
+    if (!saveSpans(spanFileName(manualCorrFileName), imageWidth, imageHeight, 2, manualSpans)) {
         QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                  tr("Could not save annotations, please try again."));
         return;
     }
+    // once saved, the combined annotations are kept up to date so they never disagree with the other two
+    if (segmentationMethod != "MANUAL"
+        && (saveCombinedAct->isChecked() || QFileInfo::exists(spanFileName(combinedAnnFileName)))) {
+        for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+            if (combinedDirtySlices[sl_no]) {
+                encodeSpans(combinedData, sl_no, combinedSpans[sl_no]);
+                combinedDirtySlices[sl_no] = 0;
+            }
+        }
+        if (!QDir().mkpath(QFileInfo(combinedAnnFileName).path())
+            || !saveSpans(spanFileName(combinedAnnFileName), imageWidth, imageHeight, 1, combinedSpans)) {
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                     tr("Could not save combined annotations, please try again."));
+            return;
+        }
+    }
 
     statusBar()->showMessage(tr("Annotations have been saved!"));
+    editLog->discard();
     unsavedChanges = false;
 }
 
@@ -1056,37 +1231,29 @@ void AnnotationManager::closeImg() {
             return;
         } else if (answer == QMessageBox::Save) {
             save();
+        } else {
+            editLog->discard();
         }
     }
     setWindowFilePath("");
-    imageLabel->setPixmap(QPixmap());
+    repaintScheduler->discard();
+    imageView->setImage(QImage());
     scrollArea->setVisible(false);
 
     loadedFileName = "";
-    loadedFileSize = 0;
     unsavedChanges = false;
     updateActions();
 
+    slicePrefetcher->cancel();
     removeComparisonFiles();
-    comparisonImageLabel->setPixmap(QPixmap());
+    sliceCache.clear();
+    comparisonImageView->setImage(QImage());
     comparisonScrollArea->setVisible(false);
+    updateLesionStats();
 }
 
 void AnnotationManager::removeComparisonFiles() {
-    for (auto*** currImageData : comparisonData) {
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] currImageData[i][j];
-            }
-            delete[] currImageData[i];
-        }
-        delete[] currImageData;
-    }
-
-    while(!comparisonData.isEmpty()) {
-        comparisonData.removeLast();
-    }
-
+    comparisonData.clear();
     comparisonFileNo = -1;
 }
 
@@ -1097,6 +1264,9 @@ void AnnotationManager::chooseSegmentationMethod(QAction* chooseMethodAct) {
             QString fileNameToRemember = loadedFileName;
             closeImg();
             loadFiles(fileNameToRemember);
+        } else if (loadJob) {
+            QString fileNameToRemember = loadJob->fileName;
+            loadFiles(fileNameToRemember);
         }
     }
 }
@@ -1108,6 +1278,9 @@ void AnnotationManager::chooseSPNumber(QAction *chooseSPNumberAct) {
             QString fileNameToRemember = loadedFileName;
             closeImg();
             loadFiles(fileNameToRemember);
+        } else if (loadJob) {
+            QString fileNameToRemember = loadJob->fileName;
+            loadFiles(fileNameToRemember);
         }
     }
 }
@@ -1123,18 +1296,161 @@ void AnnotationManager::closeEvent(QCloseEvent *event)
             save();
             event->accept();
         } else if (answer == QMessageBox::Discard) {
+            editLog->discard();
             event->accept();
         }
     }
+    if (event->isAccepted()) { stopLoading(); }
 }
 
 void AnnotationManager::resetAnnotations() {
-    for (int x = 0; x < imageWidth; x++)
-        for (int y = 0; y < imageHeight; y++) {
-            spAnnotationData[currSlice][x][y] = 0;
-            manualCorrectionsData[currSlice][x][y] = 0;
+    // recorded as one step, everything cleared comes back on undo
+    EditJournal::Step &step = journal.pending();
+    for (int y = 0; y < imageHeight; y++) {
+        const BitVolume::Word *annotationRow = spAnnotationData.row(currSlice, y);
+        for (int w = 0; w < spAnnotationData.wordsPerRow(); w++) { step.flipWord(currSlice, y, w, annotationRow[w]); }
+        const char *corrections = manualCorrectionsData.row(currSlice, y);
+        for (int x = 0; x < imageWidth; x++) {
+            if (corrections[x] != 0) { step.changeCorrection(currSlice, y, x, corrections[x], 0); }
         }
+    }
+    spAnnotationData.clearSlice(currSlice);
+    if (!spIndex.isEmpty()) { spIndex.states(currSlice).forget(); }
+    if (!svIndex.isEmpty()) { svIndex.states().forget(); } // supervoxels on the slice reach other slices
+    manualCorrectionsData.fillSlice(currSlice, 0);
+    lesionStats->add(currSlice, -lesionStats->sliceVoxels(currSlice));
+    combinedData.clearSlice(currSlice);
+    logStep(step);
+    journal.commit();
+    updateUndoActions();
+
+    spDirtySlices[currSlice] = 1;
+    manualDirtySlices[currSlice] = 1;
     updateDisplay();
+    unsavedChanges = true;
+}
+
+void AnnotationManager::undo() {
+    if (const EditJournal::Step *step = journal.undo()) {
+        replayStep(*step, true);
+    } else {
+        updateUndoActions();
+    }
+}
+
+void AnnotationManager::redo() {
+    if (const EditJournal::Step *step = journal.redo()) {
+        replayStep(*step, false);
+    } else {
+        updateUndoActions();
+    }
+}
+
+void AnnotationManager::replayStep(const EditJournal::Step &step, bool undoing) {
+    std::vector<char> flippedSlices(slicesNo, 0);
+    int firstSlice = slicesNo; // shown when the current slice did not change
+    QRect touched; // pixels of the current slice that changed
+
+    // Bit flips are their own inverse and undo each other in any order
+    auto flipSpan = [&](int slice, int y, int left, int right) {
+        BitVolume::Word *annotationRow = spAnnotationData.row(slice, y);
+        for (int w = left / BitVolume::wordBits; w <= right / BitVolume::wordBits; w++) {
+            annotationRow[w] ^= BitVolume::bitRange(std::max(0, left - w * BitVolume::wordBits),
+                                                    std::min(BitVolume::wordBits - 1, right - w * BitVolume::wordBits));
+        }
+        updateCombined(slice, y, left / BitVolume::wordBits, right / BitVolume::wordBits);
+        flippedSlices[slice] = 1;
+        firstSlice = std::min(firstSlice, slice);
+        if (slice == currSlice) { touched |= QRect(QPoint(left, y), QPoint(right, y)); }
+    };
+    for (const EditJournal::RegionFlip &regionFlip : step.regions) {
+        if (regionFlip.slice < 0) {
+            for (auto span = svIndex.spansBegin(regionFlip.region); span != svIndex.spansEnd(regionFlip.region); span++) {
+                flipSpan(span->slice, span->y, span->left, span->right);
+            }
+        } else {
+            for (auto span = spIndex.spansBegin(regionFlip.slice, regionFlip.region);
+                 span != spIndex.spansEnd(regionFlip.slice, regionFlip.region); span++) {
+                flipSpan(regionFlip.slice, span->y, span->left, span->right);
+            }
+        }
+    }
+    for (const EditJournal::BitRun &run : step.bits) { flipSpan(run.slice, run.y, run.left, run.right); }
+
+    // A correction may have changed more than once within the step, so undoing goes backwards
+    auto restoreCorrections = [&](const EditJournal::CorrectionRun &run) {
+        char *corrections = manualCorrectionsData.row(run.slice, run.y);
+        std::fill(corrections + run.left, corrections + run.right + 1, undoing ? run.before : run.after);
+        updateCombined(run.slice, run.y, run.left / BitVolume::wordBits, run.right / BitVolume::wordBits);
+        manualDirtySlices[run.slice] = 1;
+        firstSlice = std::min(firstSlice, static_cast<int>(run.slice));
+        if (run.slice == currSlice) { touched |= QRect(QPoint(run.left, run.y), QPoint(run.right, run.y)); }
+    };
+    if (undoing) {
+        std::for_each(step.corrections.rbegin(), step.corrections.rend(), restoreCorrections);
+    } else {
+        std::for_each(step.corrections.begin(), step.corrections.end(), restoreCorrections);
+    }
+
+    // What was known about whole regions of the flipped slices does not hold anymore
+    bool anyFlipped = false;
+    for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+        if (!flippedSlices[sl_no]) { continue; }
+        spDirtySlices[sl_no] = 1;
+        if (!spIndex.isEmpty()) { spIndex.states(sl_no).forget(); }
+        anyFlipped = true;
+    }
+    if (anyFlipped && !svIndex.isEmpty()) { svIndex.states().forget(); }
+
+    logStep(step);
+    unsavedChanges = true;
+    updateUndoActions();
+    if (!touched.isEmpty()) {
+        repaintScheduler->schedule(touched);
+    } else if (firstSlice < slicesNo) {
+        currSlice = firstSlice;
+        updateDisplay();
+    }
+}
+
+void AnnotationManager::logStep(const EditJournal::Step &step) {
+    for (const EditJournal::RegionFlip &regionFlip : step.regions) {
+        if (regionFlip.slice < 0) {
+            for (auto span = svIndex.spansBegin(regionFlip.region); span != svIndex.spansEnd(regionFlip.region); span++) {
+                logSpan(EditLog::SpAnnotation, span->slice, span->y, span->left, span->right);
+            }
+        } else {
+            for (auto span = spIndex.spansBegin(regionFlip.slice, regionFlip.region);
+                 span != spIndex.spansEnd(regionFlip.slice, regionFlip.region); span++) {
+                logSpan(EditLog::SpAnnotation, regionFlip.slice, span->y, span->left, span->right);
+            }
+        }
+    }
+    for (const EditJournal::BitRun &run : step.bits) { logSpan(EditLog::SpAnnotation, run.slice, run.y, run.left, run.right); }
+    for (const EditJournal::CorrectionRun &run : step.corrections) {
+        logSpan(EditLog::Corrections, run.slice, run.y, run.left, run.right);
+    }
+}
+
+void AnnotationManager::logSpan(EditLog::Plane plane, int slice, int y, int left, int right) {
+    auto value = [&](int x) -> int {
+        if (plane == EditLog::SpAnnotation) { return spAnnotationData.test(slice, x, y) ? 1 : 0; }
+        return manualCorrectionsData(slice, x, y);
+    };
+    // one record per run of equal values
+    for (int x = left; x <= right;) {
+        const int runLeft = x;
+        const int runValue = value(x);
+        while (x <= right && value(x) == runValue) { x++; }
+        editLog->append({static_cast<quint16>(slice), static_cast<quint16>(y), static_cast<quint16>(runLeft),
+                         static_cast<quint16>(x - 1), static_cast<quint8>(plane), static_cast<qint8>(runValue)});
+    }
+}
+
+void AnnotationManager::updateUndoActions() {
+    const bool filesLoaded = loadedFileName != "";
+    undoAct->setEnabled(filesLoaded && journal.canUndo());
+    redoAct->setEnabled(filesLoaded && journal.canRedo());
 }
 
 void AnnotationManager::changeAnnotationMode() {
@@ -1143,7 +1459,7 @@ void AnnotationManager::changeAnnotationMode() {
 }
 
 void AnnotationManager::increaseManualPenSize() {
-    if (manualPenSize < 10) {manualPenSize++;}
+    if (manualPenSize < maxManualPenSize) {manualPenSize++;}
 }
 
 void AnnotationManager::reduceManualPenSize() {
@@ -1162,16 +1478,22 @@ void AnnotationManager::zoomOut()
 
 void AnnotationManager::resetSize()
 {
-    imageLabel->adjustSize();
-    comparisonImageLabel->adjustSize();
+    imageView->adjustSize();
+    comparisonImageView->adjustSize();
     scaleFactor = 1.0;
 }
 
+void AnnotationManager::changeSmoothZoom() {
+    const ImageView::Resampling resampling = smoothZoomAct->isChecked() ? ImageView::Bilinear : ImageView::Nearest;
+    imageView->setResampling(resampling);
+    comparisonImageView->setResampling(resampling);
+}
+
 void AnnotationManager::scaleImages(double factor)
 {
     scaleFactor *= factor;
-    imageLabel->resize(scaleFactor * imageLabel->pixmap(Qt::ReturnByValue).size());
-    comparisonImageLabel->resize(scaleFactor * comparisonImageLabel->pixmap(Qt::ReturnByValue).size());
+    imageView->resize(scaleFactor * imageView->image().size());
+    comparisonImageView->resize(scaleFactor * comparisonImageView->image().size());
 
     adjustScrollBar(scrollArea->horizontalScrollBar(), factor);
     adjustScrollBar(scrollArea->verticalScrollBar(), factor);
@@ -1210,9 +1532,59 @@ void AnnotationManager::changeDisplayFrame() {
     updateDisplay();
 }
 
+void AnnotationManager::changeDisplayRenderStats() {
+    renderStatsLabel->setVisible(displayRenderStatsAct->isChecked());
+    updateRenderStats();
+}
+
+void AnnotationManager::setRenderCacheSize() {
+    bool ok = false;
+    const int budget = QInputDialog::getInt(this, QGuiApplication::applicationDisplayName(),
+                                            tr("Memory for cached slice images (MB):"), sliceCache.budget(),
+                                            0, 64 * 1024, 64, &ok);
+    if (ok) {
+        sliceCache.setBudget(budget);
+        updateRenderStats();
+    }
+}
+
+void AnnotationManager::updateRenderStats() {
+    if (!renderStatsLabel->isVisible()) { return; }
+    renderStatsLabel->setText(tr("%0 fps, edit to pixel %1 ms, cache %2/%3 MB, %4 hits, %5 misses, %6 decoding, %7 rendering")
+                                      .arg(repaintScheduler->framesPerSecond())
+                                      .arg(repaintScheduler->latency(), 0, 'f', 1)
+                                      .arg(sliceCache.size(), 0, 'f', 0)
+                                      .arg(sliceCache.budget())
+                                      .arg(sliceCache.hits())
+                                      .arg(sliceCache.misses())
+                                      .arg(decodeKernelName())
+                                      .arg(renderKernelName()));
+}
+
+void AnnotationManager::updateLesionStats() {
+    if (!lesionStatsDock->isVisible()) { return; }
+    if (loadedFileName == "") {
+        lesionStatsLabel->setText(tr("No image loaded"));
+        return;
+    }
+    // in mm3 as well once the spacing of the image is known
+    auto volume = [this](qint64 voxels) {
+        QString text = tr("%0 voxels").arg(voxels);
+        if (voxelVolume > 0) { text += tr(" (%0 mm%1)").arg(voxels * voxelVolume, 0, 'f', 1).arg(QChar(0x00B3)); }
+        return text;
+    };
+    const int lesions = lesionStats->lesions();
+    lesionStatsLabel->setText(tr("Slice %0/%1: %2\nTotal: %3 on %4 slices\nLesions: %5")
+                                      .arg(currSlice + 1).arg(slicesNo)
+                                      .arg(volume(lesionStats->sliceVoxels(currSlice)))
+                                      .arg(volume(lesionStats->totalVoxels()))
+                                      .arg(lesionStats->annotatedSlices())
+                                      .arg(lesions < 0 ? tr("counting...") : QString::number(lesions)));
+}
+
 void AnnotationManager::nextComparisonImage() {
     if(comparisonData.size() > 1) {
-        comparisonFileNo = (comparisonFileNo + 1) % comparisonData.size();
+        comparisonFileNo = (comparisonFileNo + 1) % static_cast<int>(comparisonData.size());
         updateDisplay();
     }
 }
@@ -1230,10 +1602,14 @@ void AnnotationManager::instructions() {
                           "This mode is permanently turned on if Manual segmentation method is chosen "
                           "It allows to make annotations regardless image segmentation. "
                           "You can adjust size of correction pen in Edit menu "
-                          "(or using B to increase and N to reduce the size).</p>"
+                          "(or using B to increase and N to reduce the size). "
+                          "With Fill enclosed regions turned on (I key) the left mouse button fills the area "
+                          "surrounded by the annotation and the right one clears the annotated region.</p>"
                           "<p>6. Remember to save annotations once you finish your work in File menu (Ctrl+S)."
                           "Annotations for all slices are saved at once. </p>"
                           "<p>7. You can load any number of additional images for comparison in File menu. "
                           "To switch to next image press C or choose proper option in View menu. </p>"
+                          "<p>8. Press L to show the lesion volume of the current slice and of the whole image "
+                          "together with the number of separate lesions.</p>"
                           ));
 }
@@ -6,13 +6,35 @@
 #include <QCloseEvent>
 #include <QSplitter>
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "bitvolume.h"
+#include "editjournal.h"
+#include "editlog.h"
+#include "floodfill.h"
+#include "imageview.h"
+#include "lesionstats.h"
+#include "rawfile.h"
+#include "repaintscheduler.h"
+#include "slicecache.h"
+#include "sliceprefetcher.h"
+#include "spanfile.h"
+#include "superpixelindex.h"
+#include "volume.h"
+
 QT_BEGIN_NAMESPACE
 class QAction;
 class QActionGroup;
+class QDockWidget;
 class QLabel;
 class QMenu;
+class QProgressBar;
 class QScrollArea;
 class QScrollBar;
+class QToolButton;
 QT_END_NAMESPACE
 
 class AnnotationManager : public QMainWindow
@@ -28,8 +50,11 @@ private slots:
     void openComparisonImg();
     void save();
     void closeImg();
+    void cancelLoading();
     void chooseSegmentationMethod(QAction* chooseMethodAct);
     void chooseSPNumber(QAction* chooseSPNumberAct);
+    void undo();
+    void redo();
     void resetAnnotations();
     void changeAnnotationMode();
     void increaseManualPenSize();
@@ -37,11 +62,14 @@ private slots:
     void zoomIn();
     void zoomOut();
     void resetSize();
+    void changeSmoothZoom();
     void nextSlice();
     void previousSlice();
     void changeDisplayGrid();
     void changeDisplayAnnotations();
     void changeDisplayFrame();
+    void changeDisplayRenderStats();
+    void setRenderCacheSize();
     void nextComparisonImage();
     void instructions();
     // TODO findMissingAnnotations() - method to find numbers of patients for which annotations have not been done yet
@@ -56,39 +84,94 @@ private:
     void mouseReleaseEvent(QMouseEvent *event) override;
 
     void manualCorrectionLine(QPoint &endPoint, const bool &adding);
-    void markPixel(const int &x, const int &y, const bool &adding);
+    // Manual correction of pixels left to right of row y on the current slice
+    void markSpan(int y, int left, int right, const bool &adding);
+    // Manual correction of the 4-connected region around position on the current slice
+    void fillRegion(const QPoint &position, const bool &adding);
+    // Superpixel annotation of a row span, clearing the corrections it makes redundant; returns the pixels changed
+    int annotateSpan(int slice, int y, int left, int right, const bool &adding);
     void markSuperPixel(const QPoint & position, const bool &adding);
     void markSuperVoxel(const QPoint &position, const bool &adding);
 
+    // Checks the paths and starts reading the volumes in the background, the image becomes editable once all are in
     bool loadFiles(const QString &fileName);
-    bool loadRaw(const QString &fileName, unsigned short ***dataArray) const;
-    bool loadRaw(const QString &fileName, char ***dataArray) const;
-    bool loadRaw(const QString &fileName, bool ***dataArray) const;
     bool loadFrame(const QString &fileName);
     bool loadComparisonFile(const QString &fileName);
-    bool saveRaw(const QString &fileName, char ***dataArray) const;
-    bool rescaleData(unsigned short ***dataArray) const;
+
+    // Volumes read by the worker threads of one loadFiles call, moved into place on the GUI thread when ready
+    struct LoadJob {
+        QString fileName;
+        Volume<unsigned short> stirData;
+        Volume<unsigned short> spData;
+        SuperpixelIndex spIndex;
+        SupervoxelIndex svIndex;
+        BitVolume spAnnotationData;
+        Volume<char> manualCorrectionsData;
+        BitVolume combinedData;
+        int recoveredEdits = 0; // records replayed from the edit log
+        std::atomic<bool> canceled {false}; // tasks not started yet are skipped
+        int pendingTasks = 0;
+    };
+    void startLoadTask(const std::function<bool(LoadJob &)> &task, const std::function<void(bool)> &finished);
+    void finishLoading();
+    void stopLoading();
 
     void updateDisplay();
+    // Re-composites only region of the current slice (image pixels), used after edits
+    void updateDisplay(const QRect &region);
+    void renderRegion(const QRect &region);
+    enum CachedLayer { StirLayer, ComparisonLayer };
+    // Greyscale slice with the grid when it is displayed, rendered on a cache miss
+    QImage baseLayer(int slice);
+    QImage comparisonLayer(int slice, int fileNo);
+    // Only read the volumes, so the prefetcher runs them on its workers
+    QImage renderBaseLayer(int slice, bool drawGrid);
+    QImage renderComparisonLayer(int slice, int fileNo) const;
+    // Renders the layers of the neighbouring slices ahead, in the background
+    void prefetchSlices();
+    void updateRenderStats();
+    void updateLesionStats();
+    // Applies a step taken from the journal to the volumes, backwards when undoing
+    void replayStep(const EditJournal::Step &step, bool undoing);
+    void updateUndoActions();
+    // Queues the final values of everything the step changed for the edit log
+    void logStep(const EditJournal::Step &step);
+    void logSpan(EditLog::Plane plane, int slice, int y, int left, int right);
+    // Recomputes words firstWord to lastWord of row y of the combined annotation, returns the change in its set voxels
+    static int combineAnnotations(const BitVolume &spAnnotation, const Volume<char> &corrections,
+                                   BitVolume &combined, int slice, int y, int firstWord, int lastWord);
+    // Same for the loaded volumes, with the lesion statistics kept in step
+    void updateCombined(int slice, int y, int firstWord, int lastWord);
     void scaleImages(double factor);
     static void adjustScrollBar(QScrollBar *scrollBar, double factor);
 
     void removeComparisonFiles();
 
-    unsigned short ***stirData;
-    unsigned short ***spData;
-    bool ***gridData;
-    char ***spAnnotationData; // sp annotation is 0 (no lesion) or 1 (lesion)
-    char ***manualCorrectionsData; // manual correction is -1 (remove from annotation), 0 (do nothing) or 1 (add to annotation)
+    Volume<unsigned short> stirData;
+    Volume<unsigned short> spData;
+    SuperpixelIndex spIndex; // superpixels of spData as row spans, built while loading unless SLIC is used
+    SupervoxelIndex svIndex; // SLIC supervoxels of spData as row spans
+    LazyMaskVolume gridData;
+    BitVolume spAnnotationData; // sp annotation is 0 (no lesion) or 1 (lesion)
+    Volume<char> manualCorrectionsData; // manual correction is -1 (remove from annotation), 0 (do nothing) or 1 (add to annotation)
+    std::vector<char> spDirtySlices; // slices changed since they were last encoded, only those are encoded on save
+    std::vector<char> manualDirtySlices;
+    // sp annotation without the removals, plus the additions - kept up to date by every edit
+    BitVolume combinedData;
+    std::vector<char> combinedDirtySlices;
+    std::vector<SliceSpans> spSpans; // encoded slices of the compact annotation files
+    std::vector<SliceSpans> manualSpans;
+    std::vector<SliceSpans> combinedSpans;
     QMap<int, QMap<int, QList<QPoint>>> frameData;
 
-    QList<unsigned short***> comparisonData;
+    std::vector<Volume<unsigned short>> comparisonData;
+    SliceCache sliceCache; // cleared whenever the volumes behind it change
     int comparisonFileNo = -1;
 
     QString spAnnFileName;
     QString manualCorrFileName;
+    QString combinedAnnFileName;
     QString loadedFileName = "";
-    qint64 loadedFileSize = 0;
     QString imageType;
     QString segmentationMethod = "LSC";
     QString spNumber = "LOWER";
@@ -97,6 +180,7 @@ private:
     int imageWidth {};
     int imageHeight {};
     int slicesNo {};
+    double voxelVolume {}; // mm3, 0 when the spacing of the image is unknown
 
     double scaleFactor = 1;
     int currSlice = 0;
@@ -109,34 +193,56 @@ private:
     bool clickedLeft = false;
     bool clickedRight = false;
 
+    static const int maxManualPenSize = 64;
     int manualPenSize = 3;
     QPoint lastManualPoint;
+    FloodFill floodFill; // buffers reused by every fill
+    EditJournal journal; // undo history of the loaded image
+    EditLog *editLog; // edits not saved yet, replayed when the image is opened again after a crash
 
-    QLabel *imageLabel;
+    ImageView *imageView;
     QScrollArea *scrollArea;
-    QLabel *comparisonImageLabel;
+    ImageView *comparisonImageView;
     QScrollArea *comparisonScrollArea;
     QSplitter* splitter;
+    QProgressBar *loadProgressBar;
+    QLabel *renderStatsLabel;
+    LesionStats *lesionStats; // of combinedData
+    QDockWidget *lesionStatsDock;
+    QLabel *lesionStatsLabel;
+    RepaintScheduler *repaintScheduler; // edits are drawn through it, at most once per display frame
+    SlicePrefetcher *slicePrefetcher; // canceled before any volume it reads changes
+    QToolButton *cancelLoadingButton;
+
+    std::shared_ptr<LoadJob> loadJob;
 
     QAction *saveAct;
+    QAction *saveCombinedAct;
     QAction *openComparisonImgAct;
     QAction *closeImgAct;
+    QAction *cancelLoadingAct;
     QActionGroup *segMethodChoiceGroup;
     QActionGroup *spNumberChoiceGroup;
     QAction *setLessSpAct;
     QAction *setMoreSpAct;
+    QAction *undoAct;
+    QAction *redoAct;
     QAction *resetAnnotationsAct;
     QAction *changeAnnotationsModeAct;
     QAction *increaseManualPenSizeAct;
     QAction *reduceManualPenSizeAct;
+    QAction *fillRegionAct;
     QAction *zoomInAct;
     QAction *zoomOutAct;
     QAction *normalSizeAct;
+    QAction *smoothZoomAct;
     QAction *nextSliceAct;
     QAction *previousSliceAct;
     QAction *displayGridAct;
     QAction *displayAnnotationsAct;
     QAction *displayFrameAct;
+    QAction *displayRenderStatsAct;
+    QAction *renderCacheSizeAct;
     QAction *nextComparisonImageAct;
 };
 
@@ -7,7 +7,6 @@
 #include <QFileDialog>
 #include <QImageReader>
 #include <QImageWriter>
-#include <QLabel>
 #include <QMenuBar>
 #include <QMessageBox>
 #include <QMimeData>
@@ -18,69 +17,37 @@
 #include <QStandardPaths>
 #include <QStatusBar>
 
+#include <algorithm>
 #include <iostream>
-#include <fstream>
 #include <queue>
+#include <utility>
+#include <cstring>
+#include <vector>
+
+#include "slicerender.h"
 
 
 AnnotationVisualizer::AnnotationVisualizer(QWidget *parent)
-        : QMainWindow(parent), imageLabel(new QLabel)
+        : QMainWindow(parent), imageView(new ImageView)
         , scrollArea(new QScrollArea)
 {
-    imageLabel->setBackgroundRole(QPalette::Base);
-    imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    imageLabel->setScaledContents(true);
+    imageView->setBackgroundRole(QPalette::Base);
+    imageView->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
 
     scrollArea->setBackgroundRole(QPalette::Dark);
-    scrollArea->setWidget(imageLabel);
+    scrollArea->setWidget(imageView);
     scrollArea->setVisible(false);
     setCentralWidget(scrollArea);
 
     createActions();
 
+    slicePrefetcher = new SlicePrefetcher(&sliceCache, this);
+
     resize(QGuiApplication::primaryScreen()->availableSize() * 3 / 5);
 }
 
 AnnotationVisualizer::~AnnotationVisualizer() {
-    if (imageHeight != 0 && imageWidth != 0 && slicesNo != 0) {
-        for (int i = 0; i < slicesNo; i++) {
-            for (int j = 0; j < imageWidth; j++) {
-                delete[] stirData[i][j];
-            }
-            delete[] stirData[i];
-        }
-        delete[] stirData;
-    }
-
-    for (int i = 0; i < slicesNo; i++) {
-        for (int j = 0; j < imageWidth; j++) {
-            delete[] gridData[i][j];
-        }
-        delete[] gridData[i];
-    }
-    delete[] gridData;
-
-    for (int i = 0; i < annotatorsList.size(); i++) {
-        for (int j = 0; j < slicesNo; j++) {
-            for (int k = 0; k < imageWidth; k++) {
-                delete[] spAnnotationData[i][j][k];
-            }
-            delete[] spAnnotationData[i][j];
-        }
-        delete[] spAnnotationData[i];
-    }
-    delete[] spAnnotationData;
-
-    for (int i = 0; i < annotatorsList.size(); i++) {
-        for (int j = 0; j < slicesNo; j++) {
-            for (int k = 0; k < imageWidth; k++) {
-                delete[] manualCorrectionsData[i][j][k];
-            }
-            delete[] manualCorrectionsData[i][j];
-        }
-        delete[] manualCorrectionsData[i];
-    }
-    delete[] manualCorrectionsData;
+    slicePrefetcher->cancel(); // its workers read the volumes
 }
 
 void AnnotationVisualizer::createActions() {
@@ -154,6 +121,9 @@ void AnnotationVisualizer::createActions() {
     normalSizeAct->setShortcut(tr("Ctrl+0"));
     normalSizeAct->setEnabled(false);
 
+    smoothZoomAct = viewMenu->addAction(tr("&Smooth zoom"), this, &AnnotationVisualizer::changeSmoothZoom);
+    smoothZoomAct->setCheckable(true);
+
     viewMenu->addSeparator();
 
     nextSliceAct = viewMenu->addAction(tr("&Next slice"), this, &AnnotationVisualizer::nextSlice);
@@ -244,30 +214,28 @@ bool AnnotationVisualizer::loadFiles(const QString &fileName){
     QFileInfo fileInfo(fileName);
     QStringList imgParams=fileInfo.fileName().split("_");
 
-    imageType = imgParams[imgParams.size()-7];
-    patientNo = imgParams[imgParams.size()-6].toInt();
-    imageWidth = imgParams[imgParams.size()-5].toInt();
-    imageHeight = imgParams[imgParams.size()-4].toInt();
-    slicesNo = imgParams[imgParams.size()-3].toInt();
-
-    stirData = new unsigned short **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        stirData[i] = new unsigned short *[imageWidth];
-
-        for (int j = 0; j < imageWidth; j++)
-            stirData[i][j] = new unsigned short [imageHeight];
+    // the image is read aside, so a file which fails to load leaves the displayed one as it was
+    VolumeInfo imageInfo;
+    Volume<unsigned short> imageData;
+    if (readVolumeInfo(fileName, volumeInfoFromFileName(fileName), imageInfo)
+        && imageInfo.dataType == VolumeInfo::UInt16 && imageInfo.slices != 0) {
+        imageData = Volume<unsigned short>(imageInfo.width, imageInfo.height, imageInfo.slices);
     }
-
-    gridData = new bool **[slicesNo];
-    for (int i = 0; i < slicesNo; i++) {
-        gridData[i] = new bool *[imageWidth];
-
-        for (int j = 0; j < imageWidth; j++)
-            gridData[i][j] = new bool [imageHeight];
+    if (imageData.isEmpty() || !loadRawRescaled(fileName, imageData)) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("Cannot load image data! Please make sure the file is complete."));
+        return false;
     }
 
-    loadRaw(fileName, stirData);
-    rescaleData(stirData);
+    slicePrefetcher->cancel();
+    sliceCache.clear();
+    imageType = imgParams[imgParams.size()-7];
+    patientNo = imgParams[imgParams.size()-6].toInt();
+    imageWidth = imageInfo.width;
+    imageHeight = imageInfo.height;
+    slicesNo = imageInfo.slices;
+    stirData = std::move(imageData);
+    gridData.close();
 
     if (segmentationMethod != "MANUAL") {
         QString spNumberVal;
@@ -286,9 +254,10 @@ bool AnnotationVisualizer::loadFiles(const QString &fileName){
                                              .arg(imageType).arg(segmentationMethod).arg(spNumberVal));
             gridDataAvailable = false;
         } else {
-            if (!loadRaw(fileDir.path() + QString(QDir::separator()) +
-                         QString("%0BorderSuperPixel%1_%2_%3_%4_%5_2_.raw").arg(spNumberVal).arg(segmentationMethod)
-                                 .arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo), gridData)) {
+            if (!gridData.open(fileDir.path() + QString(QDir::separator()) +
+                               QString("%0BorderSuperPixel%1_%2_%3_%4_%5_2_.raw").arg(spNumberVal).arg(segmentationMethod)
+                                       .arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo),
+                               imageWidth, imageHeight, slicesNo)) {
                 QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                          tr("Cannot find grid data! "
                                             "Please make sure it is available and load the file again."));
@@ -321,29 +290,11 @@ bool AnnotationVisualizer::loadFiles(const QString &fileName){
 }
 
 bool AnnotationVisualizer::loadAnnotations(const QDir& annDir) {
-    spAnnotationData = new char ***[annotatorsList.size()];
-
-    for (int i = 0; i < annotatorsList.size(); i++) {
-        spAnnotationData[i] = new char **[slicesNo];
-        for (int j = 0; j < slicesNo; j++) {
-            spAnnotationData[i][j] = new char *[imageWidth];
-
-            for (int k = 0; k < imageWidth; k++)
-                spAnnotationData[i][j][k] = new char[imageHeight]{0};
-        }
-    }
-
-    manualCorrectionsData = new char ***[annotatorsList.size()];
-
-    for (int i = 0; i < annotatorsList.size(); i++) {
-        manualCorrectionsData[i] = new char **[slicesNo];
-        for (int j = 0; j < slicesNo; j++) {
-            manualCorrectionsData[i][j] = new char *[imageWidth];
-
-            for (int k = 0; k < imageWidth; k++)
-                manualCorrectionsData[i][j][k] = new char[imageHeight]{0};
-        }
-    }
+    spAnnotationData = BitVolume(imageWidth, imageHeight, annotatorsList.size() * slicesNo);
+    manualAdditionsData = BitVolume(imageWidth, imageHeight, annotatorsList.size() * slicesNo);
+    manualRemovalsData = BitVolume(imageWidth, imageHeight, annotatorsList.size() * slicesNo);
+    combinedData = BitVolume(imageWidth, imageHeight, annotatorsList.size() * slicesNo);
+    std::vector<char> combinedLoaded(annotatorsList.size(), 0); // saved by the annotation manager
 
     if (segmentationMethod != "MANUAL") {
         QString spNumberVal;
@@ -368,7 +319,7 @@ bool AnnotationVisualizer::loadAnnotations(const QDir& annDir) {
             fileNameToLoad = currDir.path() + QString(QDir::separator()) + QString("%0spAnnotations%1_%2_%3_%4_%5_1_.raw")
                             .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
 
-            if (!loadRaw(fileNameToLoad, spAnnotationData[ann_no])) {
+            if (!loadAnnotation(fileNameToLoad, spAnnotationData, raterSlice(ann_no, 0), slicesNo)) {
                 QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                          tr("Cannot load superpixel annotations for %0%1 made by %2!")
                                                  .arg(segmentationMethod).arg(spNumberVal).arg(annotatorsList.at(ann_no)));
@@ -385,12 +336,20 @@ bool AnnotationVisualizer::loadAnnotations(const QDir& annDir) {
             fileNameToLoad = currDir.path() + QString(QDir::separator()) + QString("%0manualAnnotations%1_%2_%3_%4_%5_1_.raw")
                             .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
 
-            if (!loadRaw(fileNameToLoad, manualCorrectionsData[ann_no])) {
+            if (!loadCorrections(fileNameToLoad, manualAdditionsData, manualRemovalsData,
+                                 raterSlice(ann_no, 0), slicesNo)) {
                 QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                          tr("Cannot load manual corrections for %0%1 made by %2!")
                                                  .arg(segmentationMethod).arg(spNumberVal).arg(annotatorsList.at(ann_no)));
                 continue;
             }
+
+            fileNameToLoad = currDir.path() + "/../../combined/" + imageType + spNumberVal + segmentationMethod
+                             + QString(QDir::separator()) + QString("%0combinedAnnotations%1_%2_%3_%4_%5_1_.raw")
+                            .arg(spNumberVal).arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
+
+            combinedLoaded[ann_no] = QFileInfo::exists(spanFileName(fileNameToLoad))
+                                     && loadAnnotation(fileNameToLoad, combinedData, raterSlice(ann_no, 0), slicesNo);
         }
     } else {
         QString fileNameToLoad;
@@ -408,7 +367,8 @@ bool AnnotationVisualizer::loadAnnotations(const QDir& annDir) {
             fileNameToLoad = currDir.path() + QString(QDir::separator()) + QString("0manualAnnotations%0_%1_%2_%3_%4_1_.raw")
                             .arg(segmentationMethod).arg(patientNo).arg(imageWidth).arg(imageHeight).arg(slicesNo);
 
-            if (!loadRaw(fileNameToLoad, manualCorrectionsData[ann_no])) {
+            if (!loadCorrections(fileNameToLoad, manualAdditionsData, manualRemovalsData,
+                                 raterSlice(ann_no, 0), slicesNo)) {
                 QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                          tr("Cannot load manual corrections for %1 made by %2!")
                                                  .arg(segmentationMethod).arg(annotatorsList.at(ann_no)));
@@ -416,228 +376,162 @@ bool AnnotationVisualizer::loadAnnotations(const QDir& annDir) {
             }
         }
     }
-    return true;
-}
-
-bool AnnotationVisualizer::loadRaw(const QString &fileName, unsigned short ***dataArray) const {
-    std::ifstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::ate | std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        std::streampos size;
-        char *memBlock;
-        size = imageFileStream.tellg();
-        memBlock = new char[size];
-
-        imageFileStream.seekg(0, std::ios::beg);
-        imageFileStream.read(memBlock, size);
-
-        int currByte = 0;
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    dataArray[sl_no][x][y] = 256 * static_cast<unsigned char>(memBlock[currByte])
-                                             + static_cast<unsigned char>(memBlock[currByte + 1]);
-                    currByte += 2;
-                }
-        delete[] memBlock;
-        imageFileStream.close();
-    }
-
-    return true;
-}
 
-bool AnnotationVisualizer::loadRaw(const QString &fileName, char ***dataArray) const {
-    std::ifstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::ate | std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        std::streampos size;
-        char *memBlock;
-        size = imageFileStream.tellg();
-        memBlock = new char[size];
-
-        imageFileStream.seekg(0, std::ios::beg);
-        imageFileStream.read(memBlock, size);
-
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    dataArray[sl_no][x][y] = memBlock[sl_no * imageHeight * imageWidth + y * imageWidth + x];
-                }
-        delete[] memBlock;
-        imageFileStream.close();
+    // Combined once here, so rendering reads a ready-made mask
+    const std::size_t sliceWords = combinedData.sliceWords();
+    for (int ann_no = 0; ann_no < annotatorsList.size(); ann_no++) {
+        if (combinedLoaded[ann_no]) { continue; }
+        for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+            const BitVolume::Word *spSlice = spAnnotationData.slice(raterSlice(ann_no, sl_no));
+            const BitVolume::Word *additionsSlice = manualAdditionsData.slice(raterSlice(ann_no, sl_no));
+            const BitVolume::Word *removalsSlice = manualRemovalsData.slice(raterSlice(ann_no, sl_no));
+            BitVolume::Word *combinedSlice = combinedData.slice(raterSlice(ann_no, sl_no));
+            for (std::size_t i = 0; i < sliceWords; i++) {
+                combinedSlice[i] = (spSlice[i] & ~removalsSlice[i]) | additionsSlice[i];
+            }
+        }
     }
-
     return true;
 }
 
-bool AnnotationVisualizer::loadRaw(const QString &fileName, bool ***dataArray) const {
-    std::ifstream imageFileStream;
-    imageFileStream.open(fileName.toStdString(), std::ios::ate | std::ios::binary);
-    if (imageFileStream.fail()){
-        imageFileStream.close();
-        return false;
-    } else {
-        std::streampos size;
-        char *memBlock;
-        size = imageFileStream.tellg();
-        memBlock = new char[size];
-
-        imageFileStream.seekg(0, std::ios::beg);
-        imageFileStream.read(memBlock, size);
-
-        int currByte = 0;
-
-        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-            for (int y = 0; y < imageHeight; y++)
-                for (int x = 0; x < imageWidth; x++) {
-                    dataArray[sl_no][x][y] = 256 * static_cast<unsigned char>(memBlock[currByte])
-                                             + static_cast<unsigned char>(memBlock[currByte + 1]) > 0;
-                    currByte += 2;
-                }
-        delete[] memBlock;
-        imageFileStream.close();
+AnnotationVisualizer::DisplaySettings AnnotationVisualizer::displaySettings() const {
+    DisplaySettings settings {displayGrid && gridData.isOpen(), annotationsHidden, displayedAnnotations, {}};
+    for (int ann_no = 0; ann_no < annotatorsList.size(); ann_no++) {
+        if (annotatorsChoiceGroup->actions().at(ann_no)->isChecked()) { settings.annotators.push_back(ann_no); }
     }
-    return true;
-}
-
-bool AnnotationVisualizer::rescaleData(unsigned short ***dataArray) const {
-    unsigned short maxVal {1};
-    for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++)
-                if (maxVal < dataArray[sl_no][x][y]){ maxVal=dataArray[sl_no][x][y];}
-
-    for (int sl_no = 0; sl_no < slicesNo; sl_no++)
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++)
-                dataArray[sl_no][x][y] *= 65535 / maxVal;
-
-    return true;
+    return settings;
 }
 
 void AnnotationVisualizer::updateDisplay() {
-    QPixmap display(imageWidth, imageHeight);
-    QPainter painter(&display);
+    const DisplaySettings settings = displaySettings();
+    if (settings != renderedSettings) {
+        // images of the old settings are of no use anymore, including those still being prefetched
+        renderedSettings = settings;
+        settingsNo++;
+        slicePrefetcher->discard();
+        sliceCache.clear();
+    }
 
-    QImage stirImage (imageWidth, imageHeight, QImage::Format_RGBA64);
-    QImage gridImage (imageWidth, imageHeight, QImage::Format_RGBA64);
-    QImage annotationImage (imageWidth, imageHeight, QImage::Format_RGBA64);
+    const SliceCache::Key key {0, currSlice, settingsNo};
+    QImage display = sliceCache.find(key);
+    if (display.isNull()) {
+        display = renderSlice(currSlice, settings);
+        sliceCache.insert(key, display);
+    }
 
-    QRgba64 colorValue = {};
+    int horizontalScrollValue = scrollArea->horizontalScrollBar()->value();
+    int verticalScrollValue = scrollArea->verticalScrollBar()->value();
+    imageView->setImage(display);
+    scrollArea->setVisible(true);
+    imageView->adjustSize();
+    scaleImage(1);
+    scrollArea->horizontalScrollBar()->setValue(horizontalScrollValue);
+    scrollArea->verticalScrollBar()->setValue(verticalScrollValue);
 
-    for (int x = 0; x < imageWidth; x++)
-        for (int y = 0; y < imageHeight; y++) {
-            colorValue = qRgba64(stirData[currSlice][x][y], stirData[currSlice][x][y], stirData[currSlice][x][y], 65535);
-            stirImage.setPixelColor(x, y, colorValue);
+    if (settings.grid) {
+        // grid slices are decoded here, the workers only read them
+        const int distance = slicePrefetcher->distance();
+        for (int sl_no = std::max(0, currSlice - distance); sl_no <= std::min(slicesNo - 1, currSlice + distance); sl_no++) {
+            gridData.decode(sl_no);
         }
-    painter.drawImage(QPoint(0,0), stirImage);
-
-    if(!annotationsHidden) {
-        int displayedAnnotationsNo = 0;
+    }
+    slicePrefetcher->prefetch(currSlice, slicesNo, {{0, 0, settingsNo}}, [this, settings](const SliceKey &key) {
+        return renderSlice(key.slice, settings);
+    });
+}
 
-        char **combinedAnnotationData;
-        combinedAnnotationData = new char *[imageWidth];
-        for (int x = 0; x < imageWidth; x++) {
-            combinedAnnotationData[x] = new char[imageHeight];
-            for (int y = 0; y < imageHeight; y++) {
-                combinedAnnotationData[x][y] = 0;
+QImage AnnotationVisualizer::renderSlice(int slice, const DisplaySettings &settings) {
+    QImage display(imageWidth, imageHeight, QImage::Format_ARGB32_Premultiplied);
+
+    int displayedAnnotationsNo = 0;
+    int planesNo = 1;
+    std::size_t sliceWords = 0;
+    std::vector<BitVolume::Word> counterPlanes;
+    std::vector<quint32> palette;
+
+    if(!settings.annotationsHidden) {
+
+        // Per-pixel number of raters kept as bit-sliced counters: bit b of plane p is bit p of the count for pixel b,
+        // so adding one rater's mask updates 64 pixels per word operation
+        while ((1 << planesNo) <= annotatorsList.size()) { planesNo++; }
+        sliceWords = spAnnotationData.sliceWords();
+        counterPlanes.assign(planesNo * sliceWords, 0);
+
+        for (const int ann_no : settings.annotators) {
+            displayedAnnotationsNo ++;
+
+            const BitVolume::Word *spSlice = spAnnotationData.slice(raterSlice(ann_no, slice));
+            const BitVolume::Word *additionsSlice = manualAdditionsData.slice(raterSlice(ann_no, slice));
+            const BitVolume::Word *combinedSlice = combinedData.slice(raterSlice(ann_no, slice));
+
+            for (std::size_t i = 0; i < sliceWords; i++) {
+                BitVolume::Word mask {};
+                if (settings.displayedAnnotations == "BOTH") {
+                    mask = combinedSlice[i];
+                } else if (settings.displayedAnnotations == "SP") {
+                    mask = spSlice[i];
+                } else if (settings.displayedAnnotations == "MANUAL") {
+                    mask = additionsSlice[i];
+                }
+                for (int plane = 0; plane < planesNo && mask != 0; plane++) {
+                    BitVolume::Word &counter = counterPlanes[plane * sliceWords + i];
+                    const BitVolume::Word carry = counter & mask;
+                    counter ^= mask;
+                    mask = carry;
+                }
             }
         }
 
-        for (int ann_no = 0; ann_no < annotatorsList.size(); ann_no++) {
-            if(annotatorsChoiceGroup->actions().at(ann_no)->isChecked()){
-                displayedAnnotationsNo ++;
+        // Generate heatmap
+        palette.resize(displayedAnnotationsNo + 1);
+        for (int count = 1; count <= displayedAnnotationsNo; count++) {
+            double red{1}, green{1}, blue{1};
+            if (count < (1. + 0.25 * (displayedAnnotationsNo - 1.))) {
+                red = 0;
+                green = 4 * (count - 1.) / (displayedAnnotationsNo - 1.);
+            } else if (count < (1. + 0.5 * (displayedAnnotationsNo - 1.))) {
+                red = 0;
+                blue = 1 + 4 * (1. + 0.25 * (displayedAnnotationsNo - 1.) - count) / (displayedAnnotationsNo - 1.);
+            } else if (count < (1. + 0.75 * (displayedAnnotationsNo - 1.))) {
+                red = 4 * (count - 1. - 0.5 * (displayedAnnotationsNo - 1.)) / (displayedAnnotationsNo - 1.);
+                blue = 0;
             } else {
-                continue;
-            }
-
-            if (displayedAnnotations == "BOTH") {
-                for (int x = 0; x < imageWidth; x++)
-                    for (int y = 0; y < imageHeight; y++) {
-                        if (spAnnotationData[ann_no][currSlice][x][y] + manualCorrectionsData[ann_no][currSlice][x][y] > 0) {
-                            combinedAnnotationData[x][y]++;
-                        }
-                    }
-            } else if (displayedAnnotations == "SP") {
-                for (int x = 0; x < imageWidth; x++)
-                    for (int y = 0; y < imageHeight; y++) {
-                        if (spAnnotationData[ann_no][currSlice][x][y] == 1) {
-                            combinedAnnotationData[x][y]++;
-                        }
-                    }
-            } else if (displayedAnnotations == "MANUAL") {
-                for (int x = 0; x < imageWidth; x++)
-                    for (int y = 0; y < imageHeight; y++) {
-                        if (manualCorrectionsData[ann_no][currSlice][x][y] == 1) {
-                            combinedAnnotationData[x][y]++;
-                        }
-                    }
+                green = 1 + 4 * (1. + 0.75 * (displayedAnnotationsNo - 1.) - count) / (displayedAnnotationsNo - 1.);
+                blue = 0;
             }
+            palette[count] = qPremultiply(qRgba(static_cast<int>(255 * red), static_cast<int>(255 * green),
+                                                static_cast<int>(255 * blue), 128));
         }
+    }
 
-        // Generate heatmap
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++) {
-                if (combinedAnnotationData[x][y] > 0) {
-                    double red{1}, green{1}, blue{1};
-                    if (combinedAnnotationData[x][y] < (1. + 0.25 * (displayedAnnotationsNo - 1.))) {
-                        red = 0;
-                        green = 4 * (combinedAnnotationData[x][y] - 1.) / (displayedAnnotationsNo - 1.);
-                    } else if (combinedAnnotationData[x][y] < (1. + 0.5 * (displayedAnnotationsNo - 1.))) {
-                        red = 0;
-                        blue = 1 + 4 * (1. + 0.25 * (displayedAnnotationsNo - 1.) - combinedAnnotationData[x][y]) / (displayedAnnotationsNo - 1.);
-                    } else if (combinedAnnotationData[x][y] < (1. + 0.75 * (displayedAnnotationsNo - 1.))) {
-                        red = 4 * (combinedAnnotationData[x][y] - 1. - 0.5 * (displayedAnnotationsNo - 1.)) / (displayedAnnotationsNo - 1.);
-                        blue = 0;
-                    } else {
-                        green = 1 + 4 * (1. + 0.75 * (displayedAnnotationsNo - 1.) - combinedAnnotationData[x][y]) / (displayedAnnotationsNo - 1.);
-                        blue = 0;
-                    }
-                    colorValue = qRgba64(65535 * red, 65535 * green, 65535 * blue, 32767);
-                } else {
-                    colorValue = qRgba64(0, 0, 0, 0);
+    const quint32 gridColor = qRgba(0, 255, 0, 255);
+    const bool drawGrid = settings.grid;
+    const int rowWords = spAnnotationData.wordsPerRow();
+
+    // All layers of a row are written in one go, straight into the scanline
+    for (int y = 0; y < imageHeight; y++) {
+        auto *line = reinterpret_cast<quint32 *>(display.scanLine(y));
+        renderGreyRow(stirData.row(slice, y), line, imageWidth);
+
+        for (int w = 0; w < rowWords && !counterPlanes.empty(); w++) {
+            const std::size_t i = static_cast<std::size_t>(y) * rowWords + w;
+            BitVolume::Word marked {};
+            for (int plane = 0; plane < planesNo; plane++) { marked |= counterPlanes[plane * sliceWords + i]; }
+
+            for (; marked != 0; marked &= marked - 1) {
+                const int bit = BitVolume::lowestBit(marked);
+                int count = 0;
+                for (int plane = 0; plane < planesNo; plane++) {
+                    count |= static_cast<int>((counterPlanes[plane * sliceWords + i] >> bit) & 1u) << plane;
                 }
-                annotationImage.setPixelColor(x, y, colorValue);
+                quint32 &pixel = line[w * BitVolume::wordBits + bit];
+                pixel = blendPixel(pixel, palette[count]);
             }
-
-        painter.drawImage(QPoint(0,0), annotationImage);
-
-        for (int x = 0; x < imageWidth; x++) {
-            delete[] combinedAnnotationData[x];
         }
-        delete[] combinedAnnotationData;
-
-    }
 
-    if(displayGrid) {
-        for (int x = 0; x < imageWidth; x++)
-            for (int y = 0; y < imageHeight; y++) {
-                if (gridData[currSlice][x][y]) {
-                    colorValue = qRgba64(0, 65535, 0, 65535);
-                } else {
-                    colorValue = qRgba64(0, 65535, 0, 0);
-                }
-                gridImage.setPixelColor(x, y, colorValue);
-            }
-        painter.drawImage(QPoint(0,0), gridImage);
+        if (drawGrid) { paintMaskRow(gridData.row(slice, y), gridColor, line, imageWidth); }
     }
-
-    painter.end();
-
-    int horizontalScrollValue = scrollArea->horizontalScrollBar()->value();
-    int verticalScrollValue = scrollArea->verticalScrollBar()->value();
-    imageLabel->setPixmap(display);
-    scrollArea->setVisible(true);
-    imageLabel->adjustSize();
-    scaleImage(1);
-    scrollArea->horizontalScrollBar()->setValue(horizontalScrollValue);
-    scrollArea->verticalScrollBar()->setValue(verticalScrollValue);
+    return display;
 }
 
 void AnnotationVisualizer::open() {
@@ -689,14 +583,16 @@ void AnnotationVisualizer::save() {
                                  tr("Saving image failed, please try again!"));
         return;
     }
-    imageLabel->pixmap(Qt::ReturnByValue).save(&imageFile, "PNG");
+    imageView->image().save(&imageFile, "PNG");
 
     lastFileDir =QFileInfo(filename).absoluteDir();
 }
 
 void AnnotationVisualizer::closeImg() {
     setWindowFilePath("");
-    imageLabel->setPixmap(QPixmap());
+    imageView->setImage(QImage());
+    slicePrefetcher->cancel();
+    sliceCache.clear();
     loadedFileName = "";
     updateActions();
     setLessSpAct->setText(tr("Lower (bigger regions)"));
@@ -737,14 +633,18 @@ void AnnotationVisualizer::zoomOut()
 
 void AnnotationVisualizer::resetSize()
 {
-    imageLabel->adjustSize();
+    imageView->adjustSize();
     scaleFactor = 1.0;
 }
 
+void AnnotationVisualizer::changeSmoothZoom() {
+    imageView->setResampling(smoothZoomAct->isChecked() ? ImageView::Bilinear : ImageView::Nearest);
+}
+
 void AnnotationVisualizer::scaleImage(double factor)
 {
     scaleFactor *= factor;
-    imageLabel->resize(scaleFactor * imageLabel->pixmap(Qt::ReturnByValue).size());
+    imageView->resize(scaleFactor * imageView->image().size());
 
     adjustScrollBar(scrollArea->horizontalScrollBar(), factor);
     adjustScrollBar(scrollArea->verticalScrollBar(), factor);
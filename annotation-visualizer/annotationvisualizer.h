@@ -6,10 +6,19 @@
 #include <QCloseEvent>
 #include <QDir>
 
+#include <vector>
+
+#include "bitvolume.h"
+#include "imageview.h"
+#include "rawfile.h"
+#include "slicecache.h"
+#include "sliceprefetcher.h"
+#include "spanfile.h"
+#include "volume.h"
+
 QT_BEGIN_NAMESPACE
 class QAction;
 class QActionGroup;
-class QLabel;
 class QMenu;
 class QScrollArea;
 class QScrollBar;
@@ -32,6 +41,7 @@ private slots:
     void zoomIn();
     void zoomOut();
     void resetSize();
+    void changeSmoothZoom();
     void nextSlice();
     void previousSlice();
     void changeDisplayGrid();
@@ -46,19 +56,36 @@ private:
 
     bool loadFiles(const QString &fileName);
     bool loadAnnotations(const QDir& currDir);
-    bool loadRaw(const QString &fileName, unsigned short ***dataArray) const;
-    bool loadRaw(const QString &fileName, char ***dataArray) const;
-    bool loadRaw(const QString &fileName, bool ***dataArray) const;
-    bool rescaleData(unsigned short ***dataArray) const;
+    int raterSlice(int annotatorNo, int slice) const { return annotatorNo * slicesNo + slice; }
+
+    // What the displayed image depends on besides the slice, read from the actions on the GUI thread
+    struct DisplaySettings {
+        bool grid;
+        bool annotationsHidden;
+        QString displayedAnnotations;
+        std::vector<int> annotators;
+
+        bool operator==(const DisplaySettings &other) const {
+            return grid == other.grid && annotationsHidden == other.annotationsHidden
+                   && displayedAnnotations == other.displayedAnnotations && annotators == other.annotators;
+        }
+        bool operator!=(const DisplaySettings &other) const { return !(*this == other); }
+    };
+    DisplaySettings displaySettings() const;
 
     void updateDisplay();
+    // Only reads the volumes, so the prefetcher runs it on its workers
+    QImage renderSlice(int slice, const DisplaySettings &settings);
     void scaleImage(double factor);
     static void adjustScrollBar(QScrollBar *scrollBar, double factor);
 
-    unsigned short ***stirData;
-    bool ***gridData;
-    char ****spAnnotationData; // sp annotation is 0 (no lesion) or 1 (lesion)
-    char ****manualCorrectionsData; // manual correction is -1 (remove from annotation), 0 (do nothing) or 1 (add to annotation)
+    Volume<unsigned short> stirData;
+    LazyMaskVolume gridData;
+    // Annotations of all raters in one rater-major block each, slice sl_no of rater ann_no is raterSlice(ann_no, sl_no)
+    BitVolume spAnnotationData; // sp annotation is 0 (no lesion) or 1 (lesion)
+    BitVolume manualAdditionsData; // manual corrections equal to 1 (add to annotation)
+    BitVolume manualRemovalsData; // manual corrections equal to -1 (remove from annotation)
+    BitVolume combinedData; // sp annotation without the removals, plus the additions
 
     QStringList annotatorsList;
 
@@ -79,9 +106,15 @@ private:
     bool gridDataAvailable = false;
     bool annotationsHidden = false;
 
+    // Composited slices of the current settings, settingsNo is the variant they are cached under
+    SliceCache sliceCache;
+    SlicePrefetcher *slicePrefetcher; // canceled before any volume it reads changes
+    DisplaySettings renderedSettings {};
+    int settingsNo = 0;
+
     QMenu *annotationsMenu;
 
-    QLabel *imageLabel;
+    ImageView *imageView;
     QScrollArea *scrollArea;
 
     QAction *saveAct;
@@ -93,6 +126,7 @@ private:
     QAction *zoomInAct;
     QAction *zoomOutAct;
     QAction *normalSizeAct;
+    QAction *smoothZoomAct;
     QAction *nextSliceAct;
     QAction *previousSliceAct;
     QAction *displayGridAct;
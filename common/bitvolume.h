@@ -0,0 +1,106 @@
+#ifndef BITVOLUME_H
+#define BITVOLUME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Binary 3D mask packed 64 voxels per word. Every row of every slice starts on a word boundary,
+// so rows can be combined word by word; padding bits past imageWidth are always 0.
+class BitVolume {
+public:
+    typedef std::uint64_t Word;
+    static constexpr int wordBits = 64;
+
+    BitVolume() = default;
+
+    BitVolume(int width, int height, int slices)
+            : imageWidth(width), imageHeight(height), slicesNo(slices), rowWords((width + wordBits - 1) / wordBits),
+              words(static_cast<std::size_t>(rowWords) * height * slices, 0) {}
+
+    bool test(int slice, int x, int y) const { return (row(slice, y)[x / wordBits] >> (x % wordBits)) & 1u; }
+    void set(int slice, int x, int y) { row(slice, y)[x / wordBits] |= Word(1) << (x % wordBits); }
+    void reset(int slice, int x, int y) { row(slice, y)[x / wordBits] &= ~(Word(1) << (x % wordBits)); }
+    void assign(int slice, int x, int y, bool value) { value ? set(slice, x, y) : reset(slice, x, y); }
+
+    Word *row(int slice, int y) { return words.data() + (static_cast<std::size_t>(slice) * imageHeight + y) * rowWords; }
+    const Word *row(int slice, int y) const {
+        return words.data() + (static_cast<std::size_t>(slice) * imageHeight + y) * rowWords;
+    }
+    Word *slice(int slice) { return row(slice, 0); }
+    const Word *slice(int slice) const { return row(slice, 0); }
+
+    void clear() { std::fill(words.begin(), words.end(), 0); }
+    void clearSlice(int slice) { std::fill_n(this->slice(slice), sliceWords(), 0); }
+
+    std::size_t count() const { return popcount(words.data(), words.size()); }
+    std::size_t countSlice(int slice) const { return popcount(this->slice(slice), sliceWords()); }
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int slices() const { return slicesNo; }
+    int wordsPerRow() const { return rowWords; }
+    std::size_t sliceWords() const { return static_cast<std::size_t>(rowWords) * imageHeight; }
+    bool isEmpty() const { return words.empty(); }
+
+    // Mask of valid bits in the last word of a row
+    Word lastWordMask() const {
+        return imageWidth % wordBits == 0 ? ~Word(0) : (Word(1) << (imageWidth % wordBits)) - 1;
+    }
+
+    static int popcount(Word word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        return static_cast<int>(__popcnt64(word));
+#else
+        word = word - ((word >> 1) & 0x5555555555555555ULL);
+        word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+        word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return static_cast<int>((word * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+
+    // Index of the lowest set bit, word must not be 0
+    static int lowestBit(Word word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return static_cast<int>(index);
+#else
+        int index = 0;
+        while (!(word & 1u)) { word >>= 1; index++; }
+        return index;
+#endif
+    }
+
+    // Bits from..to (both 0-63) of a word
+    static Word bitRange(int from, int to) { return (~Word(0) << from) & (~Word(0) >> (wordBits - 1 - to)); }
+
+    static std::size_t popcount(const Word *data, std::size_t n) {
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < n; i++) { total += popcount(data[i]); }
+        return total;
+    }
+
+    static void andWords(Word *dst, const Word *src, std::size_t n) { for (std::size_t i = 0; i < n; i++) dst[i] &= src[i]; }
+    static void orWords(Word *dst, const Word *src, std::size_t n) { for (std::size_t i = 0; i < n; i++) dst[i] |= src[i]; }
+    static void xorWords(Word *dst, const Word *src, std::size_t n) { for (std::size_t i = 0; i < n; i++) dst[i] ^= src[i]; }
+    static void andNotWords(Word *dst, const Word *src, std::size_t n) { for (std::size_t i = 0; i < n; i++) dst[i] &= ~src[i]; }
+
+private:
+    int imageWidth {};
+    int imageHeight {};
+    int slicesNo {};
+    int rowWords {};
+    std::vector<Word> words;
+};
+
+#endif
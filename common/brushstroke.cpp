@@ -0,0 +1,55 @@
+#include "brushstroke.h"
+
+#include <climits>
+#include <cstdlib>
+#include <map>
+
+const std::vector<int> &discHalfWidths(int radius) {
+    static std::map<int, std::vector<int>> tables;
+    std::vector<int> &halfWidths = tables[radius];
+    if (halfWidths.empty()) {
+        halfWidths.resize(radius + 1);
+        int width = 0;
+        // integer square roots of radius^2 - dy^2, widths only grow towards the centre row
+        for (int dy = radius; dy >= 0; dy--) {
+            const int squared = radius * radius - dy * dy;
+            while ((width + 1) * (width + 1) <= squared) { width++; }
+            halfWidths[dy] = width;
+        }
+    }
+    return halfWidths;
+}
+
+BrushStroke::BrushStroke(const QPoint &from, const QPoint &to, int radius)
+        : top(std::min(from.y(), to.y()) - radius), left(std::min(from.x(), to.x()) - radius),
+          right(std::max(from.x(), to.x()) + radius),
+          rowLeft(std::abs(to.y() - from.y()) + 2 * radius + 1, INT_MAX),
+          rowRight(std::abs(to.y() - from.y()) + 2 * radius + 1, INT_MIN) {
+    const std::vector<int> &halfWidths = discHalfWidths(radius);
+
+    int x0 = from.x();
+    int y0 = from.y();
+    const int x1 = to.x();
+    const int y1 = to.y();
+    const int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    const int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy; // error value e_xy
+
+    while (true) {
+        addDisc(QPoint(x0, y0), halfWidths);
+        if (x0 == x1 && y0 == y1) { break; }
+        const int err2 = 2 * err;
+        if (err2 >= dy) { err += dy; x0 += sx; } // e_xy+e_x > 0
+        if (err2 <= dx) { err += dx; y0 += sy; } // e_xy+e_y < 0
+    }
+}
+
+void BrushStroke::addDisc(const QPoint &centre, const std::vector<int> &halfWidths) {
+    const int radius = static_cast<int>(halfWidths.size()) - 1;
+    for (int dy = -radius; dy <= radius; dy++) {
+        const int halfWidth = halfWidths[std::abs(dy)];
+        const int row = centre.y() + dy - top;
+        rowLeft[row] = std::min(rowLeft[row], centre.x() - halfWidth);
+        rowRight[row] = std::max(rowRight[row], centre.x() + halfWidth);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef BRUSHSTROKE_H
+#define BRUSHSTROKE_H
+
+#include <QPoint>
+#include <QRect>
+
+#include <algorithm>
+#include <vector>
+
+// Half widths of the rows of a disc, row dy (-radius..radius) spanning -w..w with w = halfWidths[|dy|].
+// Computed once per radius.
+const std::vector<int> &discHalfWidths(int radius);
+
+// Pixels covered by the discs centred at every point of a line (Bresenham), kept as one span per row:
+// neighbouring discs overlap in every row they share, so their union is a single span per row
+// and each pixel is written once however densely the discs are stamped.
+class BrushStroke {
+public:
+    BrushStroke(const QPoint &from, const QPoint &to, int radius);
+
+    QRect boundingRect() const {
+        return QRect(QPoint(left, top), QPoint(right, top + static_cast<int>(rowLeft.size()) - 1));
+    }
+
+    // Calls span(y, left, right) for every row, clipped to bounds
+    template<typename Span>
+    void forEachSpan(const QRect &bounds, Span span) const {
+        const int firstRow = std::max(top, bounds.top());
+        const int lastRow = std::min(top + static_cast<int>(rowLeft.size()) - 1, bounds.bottom());
+        for (int y = firstRow; y <= lastRow; y++) {
+            const int left = std::max(rowLeft[y - top], bounds.left());
+            const int right = std::min(rowRight[y - top], bounds.right());
+            if (left <= right) { span(y, left, right); }
+        }
+    }
+
+private:
+    void addDisc(const QPoint &centre, const std::vector<int> &halfWidths);
+
+    int top;
+    int left; // over all rows
+    int right;
+    std::vector<int> rowLeft;
+    std::vector<int> rowRight;
+};
+
+#endif
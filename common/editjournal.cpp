@@ -0,0 +1,93 @@
+#include "editjournal.h"
+
+#include <utility>
+
+std::size_t EditJournal::Step::bytes() const {
+    return regions.size() * sizeof(RegionFlip) + bits.size() * sizeof(BitRun) + corrections.size() * sizeof(CorrectionRun);
+}
+
+void EditJournal::Step::flipBits(int slice, int y, int left, int right) {
+    if (!bits.empty()) {
+        BitRun &last = bits.back();
+        if (last.slice == slice && last.y == y && last.right + 1 == left) {
+            last.right = static_cast<unsigned short>(right);
+            return;
+        }
+    }
+    bits.push_back({static_cast<unsigned short>(slice), static_cast<unsigned short>(y),
+                    static_cast<unsigned short>(left), static_cast<unsigned short>(right)});
+}
+
+void EditJournal::Step::flipWord(int slice, int y, int w, BitVolume::Word bits) {
+    while (bits != 0) {
+        const int first = BitVolume::lowestBit(bits);
+        const BitVolume::Word beyondRun = ~(bits >> first);
+        const int length = beyondRun == 0 ? BitVolume::wordBits : BitVolume::lowestBit(beyondRun);
+        flipBits(slice, y, w * BitVolume::wordBits + first, w * BitVolume::wordBits + first + length - 1);
+        if (first + length == BitVolume::wordBits) { break; }
+        bits &= ~BitVolume::Word(0) << (first + length);
+    }
+}
+
+void EditJournal::Step::changeCorrection(int slice, int y, int x, char before, char after) {
+    if (!corrections.empty()) {
+        CorrectionRun &last = corrections.back();
+        if (last.slice == slice && last.y == y && last.right + 1 == x && last.before == before && last.after == after) {
+            last.right = static_cast<unsigned short>(x);
+            return;
+        }
+    }
+    corrections.push_back({static_cast<unsigned short>(slice), static_cast<unsigned short>(y),
+                           static_cast<unsigned short>(x), static_cast<unsigned short>(x), before, after});
+}
+
+void EditJournal::Step::flipRegion(const Mark &since, int slice, int region) {
+    bits.resize(since.runs);
+    if (since.runs > 0) { bits.back() = since.last; } // the first new run may have been merged into it
+    regions.push_back({slice, region});
+}
+
+EditJournal::EditJournal(int budgetMB) : budget(static_cast<std::size_t>(budgetMB) << 20) {}
+
+void EditJournal::commit() {
+    if (pendingStep.isEmpty()) { return; }
+    for (const Step &step : redoSteps) { usedBytes -= step.bytes(); }
+    redoSteps.clear();
+
+    pendingStep.regions.shrink_to_fit();
+    pendingStep.bits.shrink_to_fit();
+    pendingStep.corrections.shrink_to_fit();
+    usedBytes += pendingStep.bytes();
+    undoSteps.push_back(std::move(pendingStep));
+    pendingStep = Step();
+    trim();
+}
+
+const EditJournal::Step *EditJournal::undo() {
+    commit(); // an edit still in progress is undone first
+    if (undoSteps.empty()) { return nullptr; }
+    redoSteps.push_back(std::move(undoSteps.back()));
+    undoSteps.pop_back();
+    return &redoSteps.back();
+}
+
+const EditJournal::Step *EditJournal::redo() {
+    if (!canRedo()) { return nullptr; }
+    undoSteps.push_back(std::move(redoSteps.back()));
+    redoSteps.pop_back();
+    return &undoSteps.back();
+}
+
+void EditJournal::clear() {
+    pendingStep = Step();
+    undoSteps.clear();
+    redoSteps.clear();
+    usedBytes = 0;
+}
+
+void EditJournal::trim() {
+    while (usedBytes > budget && undoSteps.size() > 1) {
+        usedBytes -= undoSteps.front().bytes();
+        undoSteps.pop_front();
+    }
+}
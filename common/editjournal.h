@@ -0,0 +1,89 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "bitvolume.h"
+
+// Undo history of annotation edits kept as deltas rather than slice snapshots. A superpixel or supervoxel edit
+// that flipped its whole region is stored as the region alone, anything else as runs of flipped annotation bits
+// and of replaced corrections. The oldest steps are dropped once the history outgrows its budget.
+class EditJournal {
+public:
+    static const int defaultBudgetMB = 64;
+
+    // Every pixel of superpixel region of slice, or of supervoxel region when slice is -1, flipped
+    struct RegionFlip {
+        int slice;
+        int region;
+    };
+    // Superpixel annotation bits left to right of row y flipped
+    struct BitRun {
+        unsigned short slice;
+        unsigned short y;
+        unsigned short left;
+        unsigned short right;
+    };
+    // Manual corrections left to right of row y changed from before to after
+    struct CorrectionRun {
+        unsigned short slice;
+        unsigned short y;
+        unsigned short left;
+        unsigned short right;
+        char before;
+        char after;
+    };
+
+    struct Step {
+        std::vector<RegionFlip> regions;
+        std::vector<BitRun> bits;
+        std::vector<CorrectionRun> corrections; // undone backwards, a pixel may change more than once
+
+        bool isEmpty() const { return regions.empty() && bits.empty() && corrections.empty(); }
+        std::size_t bytes() const;
+
+        // Merged with the previous run when it ends right before
+        void flipBits(int slice, int y, int left, int right);
+        // Runs of the set bits of word w of row y
+        void flipWord(int slice, int y, int w, BitVolume::Word bits);
+        void changeCorrection(int slice, int y, int x, char before, char after);
+
+        // Bit runs recorded so far, to be replaced by a region flip when it turns out the whole region flipped
+        struct Mark {
+            std::size_t runs;
+            BitRun last;
+        };
+        Mark mark() const { return {bits.size(), bits.empty() ? BitRun() : bits.back()}; }
+        void flipRegion(const Mark &since, int slice, int region);
+    };
+
+    explicit EditJournal(int budgetMB = defaultBudgetMB);
+
+    // Changes recorded since the last commit
+    Step &pending() { return pendingStep; }
+    // Makes the pending changes one undo step and forgets the undone steps
+    void commit();
+
+    bool canUndo() const { return !undoSteps.empty() || !pendingStep.isEmpty(); }
+    bool canRedo() const { return !redoSteps.empty() && pendingStep.isEmpty(); }
+    // Move the step to the other stack and return it to be replayed, valid until the journal changes,
+    // nullptr when there is nothing to undo or redo
+    const Step *undo();
+    const Step *redo();
+
+    void clear();
+
+private:
+    // Drops the oldest steps until the history fits in the budget, the newest step is kept even when it alone does not
+    void trim();
+
+    std::size_t budget;
+    std::size_t usedBytes = 0;
+    Step pendingStep;
+    std::deque<Step> undoSteps;
+    std::deque<Step> redoSteps;
+};
+
+#endif
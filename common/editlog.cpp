@@ -0,0 +1,209 @@
+#include "editlog.h"
+
+#include <QByteArray>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char logMagic[4] = {'M', 'R', 'I', 'L'};
+const quint16 logVersion = 1;
+const int headerBytes = 20;
+const int batchHeaderBytes = 8;
+const int recordBytes = 10;
+
+quint32 checksum(const uchar *data, std::size_t size) {
+    quint32 hash = 2166136261u;
+    for (std::size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+EditLog::Record readRecord(const uchar *data) {
+    EditLog::Record record;
+    record.slice = qFromLittleEndian<quint16>(data);
+    record.y = qFromLittleEndian<quint16>(data + 2);
+    record.left = qFromLittleEndian<quint16>(data + 4);
+    record.right = qFromLittleEndian<quint16>(data + 6);
+    record.plane = data[8];
+    record.value = static_cast<qint8>(data[9]);
+    return record;
+}
+
+void writeRecord(const EditLog::Record &record, uchar *data) {
+    qToLittleEndian<quint16>(record.slice, data);
+    qToLittleEndian<quint16>(record.y, data + 2);
+    qToLittleEndian<quint16>(record.left, data + 4);
+    qToLittleEndian<quint16>(record.right, data + 6);
+    data[8] = record.plane;
+    data[9] = static_cast<uchar>(record.value);
+}
+
+// Validates the header and hands the records of every complete batch to apply,
+// returns where the last complete batch ends (0 when the header does not match)
+template<typename Apply>
+int parseLog(const QByteArray &log, int width, int height, int slices, Apply apply) {
+    const auto *data = reinterpret_cast<const uchar *>(log.constData());
+    if (log.size() < headerBytes || std::memcmp(data, logMagic, sizeof(logMagic)) != 0
+        || qFromLittleEndian<quint16>(data + 4) != logVersion
+        || qFromLittleEndian<quint32>(data + 8) != static_cast<quint32>(width)
+        || qFromLittleEndian<quint32>(data + 12) != static_cast<quint32>(height)
+        || qFromLittleEndian<quint32>(data + 16) != static_cast<quint32>(slices)) {
+        return 0;
+    }
+
+    int batchStart = headerBytes;
+    while (log.size() - batchStart >= batchHeaderBytes) {
+        const quint32 recordsNo = qFromLittleEndian<quint32>(data + batchStart);
+        const uchar *records = data + batchStart + batchHeaderBytes;
+        if (static_cast<quint64>(log.size() - batchStart - batchHeaderBytes) < static_cast<quint64>(recordsNo) * recordBytes
+            || checksum(records, recordsNo * recordBytes) != qFromLittleEndian<quint32>(data + batchStart + 4)) {
+            break;
+        }
+        for (quint32 i = 0; i < recordsNo; i++) {
+            const EditLog::Record record = readRecord(records + i * recordBytes);
+            if (record.slice < slices && record.y < height && record.left <= record.right && record.right < width) {
+                apply(record);
+            }
+        }
+        batchStart += batchHeaderBytes + static_cast<int>(recordsNo) * recordBytes;
+    }
+    return batchStart;
+}
+
+// Down to the disk, not just to the OS
+void syncFile(QFile &file) {
+    file.flush();
+#ifdef Q_OS_WIN
+    _commit(file.handle());
+#else
+    fsync(file.handle());
+#endif
+}
+
+}
+
+EditLog::EditLog(QObject *parent) : QObject(parent) {
+    writer.setMaxThreadCount(1);
+    batchTimer.setSingleShot(true);
+    batchTimer.setInterval(batchDelayMs);
+    connect(&batchTimer, &QTimer::timeout, this, [this]() {
+        QtConcurrent::run(&writer, [this, batch = takeQueued()]() { writeBatch(batch); });
+    });
+}
+
+EditLog::~EditLog() {
+    close();
+    writer.waitForDone();
+}
+
+QString EditLog::logFileName(const QString &rawFileName) {
+    QString fileName = rawFileName;
+    if (fileName.endsWith(".raw")) { fileName.chop(4); }
+    return fileName + ".wal";
+}
+
+int EditLog::replay(const QString &fileName, BitVolume &spAnnotation, Volume<char> &corrections) {
+    writer.waitForDone(); // the file may still be written after close()
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) { return 0; }
+    int applied = 0;
+    parseLog(file.readAll(), corrections.width(), corrections.height(), corrections.slices(), [&](const Record &record) {
+        if (record.plane == SpAnnotation && !spAnnotation.isEmpty()) {
+            BitVolume::Word *row = spAnnotation.row(record.slice, record.y);
+            for (int w = record.left / BitVolume::wordBits; w <= record.right / BitVolume::wordBits; w++) {
+                const BitVolume::Word bits = BitVolume::bitRange(std::max(0, record.left - w * BitVolume::wordBits),
+                                                                 std::min(BitVolume::wordBits - 1, record.right - w * BitVolume::wordBits));
+                row[w] = record.value != 0 ? row[w] | bits : row[w] & ~bits;
+            }
+        } else if (record.plane == Corrections) {
+            char *row = corrections.row(record.slice, record.y);
+            std::fill(row + record.left, row + record.right + 1, static_cast<char>(record.value));
+        }
+        applied++;
+    });
+    return applied;
+}
+
+void EditLog::open(const QString &fileName, int width, int height, int slices) {
+    close();
+    openFileName = fileName;
+    QtConcurrent::run(&writer, [this, fileName, width, height, slices]() {
+        file.setFileName(fileName);
+        if (!file.open(QIODevice::ReadWrite)) { return; }
+        const int logEnd = parseLog(file.readAll(), width, height, slices, [](const Record &) {});
+        if (logEnd == 0) {
+            uchar header[headerBytes];
+            std::memcpy(header, logMagic, sizeof(logMagic));
+            qToLittleEndian<quint16>(logVersion, header + 4);
+            qToLittleEndian<quint16>(0, header + 6);
+            qToLittleEndian<quint32>(static_cast<quint32>(width), header + 8);
+            qToLittleEndian<quint32>(static_cast<quint32>(height), header + 12);
+            qToLittleEndian<quint32>(static_cast<quint32>(slices), header + 16);
+            file.resize(0);
+            file.seek(0);
+            file.write(reinterpret_cast<const char *>(header), headerBytes);
+        } else {
+            file.resize(logEnd);
+            file.seek(logEnd);
+        }
+        syncFile(file);
+    });
+}
+
+void EditLog::append(const Record &record) {
+    if (!isOpen()) { return; }
+    queued.push_back(record);
+    if (!batchTimer.isActive()) { batchTimer.start(); }
+}
+
+void EditLog::discard() {
+    if (!isOpen()) { return; }
+    batchTimer.stop();
+    queued.clear();
+    QtConcurrent::run(&writer, [this]() {
+        if (!file.isOpen()) { return; }
+        file.resize(headerBytes);
+        file.seek(headerBytes);
+        syncFile(file);
+    });
+}
+
+void EditLog::close() {
+    if (!isOpen()) { return; }
+    batchTimer.stop();
+    openFileName.clear();
+    QtConcurrent::run(&writer, [this, batch = takeQueued()]() {
+        writeBatch(batch);
+        file.close();
+    });
+}
+
+std::vector<EditLog::Record> EditLog::takeQueued() {
+    std::vector<Record> batch;
+    batch.swap(queued);
+    return batch;
+}
+
+void EditLog::writeBatch(const std::vector<Record> &batch) {
+    if (batch.empty() || !file.isOpen()) { return; }
+
+    QByteArray data(batchHeaderBytes + static_cast<int>(batch.size()) * recordBytes, Qt::Uninitialized);
+    auto *bytes = reinterpret_cast<uchar *>(data.data());
+    for (std::size_t i = 0; i < batch.size(); i++) { writeRecord(batch[i], bytes + batchHeaderBytes + i * recordBytes); }
+    qToLittleEndian<quint32>(static_cast<quint32>(batch.size()), bytes);
+    qToLittleEndian<quint32>(checksum(bytes + batchHeaderBytes, batch.size() * recordBytes), bytes + 4);
+    file.write(data);
+    syncFile(file);
+}
@@ -0,0 +1,75 @@
+#ifndef EDITLOG_H
+#define EDITLOG_H
+
+#include <QFile>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <vector>
+
+#include "bitvolume.h"
+#include "volume.h"
+
+// Write-ahead log of annotation edits, kept next to the annotation files while an image is open and emptied
+// whenever the annotations are saved, so after a crash it holds exactly the edits missing from the saved files.
+// Records are queued on the GUI thread and handed in batches to a single writer thread which writes and syncs them.
+// Every record gives the final value of its voxels, so replaying edits already saved changes nothing.
+// Layout, all numbers little endian:
+//   header: char[4] "MRIL", quint16 version, quint16 0, quint32 width, quint32 height, quint32 slices
+//   batches: quint32 recordsNo, quint32 checksum (FNV-1a of the records), then recordsNo records of
+//            quint16 slice, y, left, right, quint8 plane, qint8 value
+// A batch cut short by a crash fails its checksum and ends the log.
+class EditLog : public QObject
+{
+Q_OBJECT
+
+public:
+    enum Plane { SpAnnotation, Corrections };
+
+    // Voxels left to right of row y now all equal value
+    struct Record {
+        quint16 slice;
+        quint16 y;
+        quint16 left;
+        quint16 right;
+        quint8 plane;
+        qint8 value;
+    };
+
+    static const int batchDelayMs = 500;
+
+    explicit EditLog(QObject *parent = nullptr);
+    ~EditLog() override;
+
+    // Kept next to the legacy .raw name of the manual corrections with a .wal extension
+    static QString logFileName(const QString &rawFileName);
+    // Applies the complete batches of a log matching the volumes, returns the number of records applied.
+    // Runs on any thread once the log is closed, after the writer is done with the file.
+    int replay(const QString &fileName, BitVolume &spAnnotation, Volume<char> &corrections);
+
+    // Appends to fileName from now on; a log of other dimensions is started over, a torn last batch dropped.
+    // Queued behind whatever the writer still has to do for the previous file.
+    void open(const QString &fileName, int width, int height, int slices);
+    bool isOpen() const { return !openFileName.isEmpty(); }
+    void append(const Record &record);
+    // Empties the log, everything appended so far has been saved or is not wanted anymore
+    void discard();
+    // Writes the queued records and closes the file
+    void close();
+
+private:
+    // Queued records are taken on the GUI thread, so those appended after reopening go to the new file
+    std::vector<Record> takeQueued();
+    // All file access runs on the writer thread, in the order it was requested
+    void writeBatch(const std::vector<Record> &batch);
+
+    QThreadPool writer;
+    QTimer batchTimer;
+    QString openFileName;
+    std::vector<Record> queued;
+    QFile file; // writer thread only
+};
+
+#endif
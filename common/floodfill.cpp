@@ -0,0 +1,32 @@
+#include "floodfill.h"
+
+#include <algorithm>
+
+void FloodFill::start(int width, int height) {
+    if (width != bitmapWidth || height != bitmapHeight) {
+        bitmapWidth = width;
+        bitmapHeight = height;
+        rowWords = (width + BitVolume::wordBits - 1) / BitVolume::wordBits;
+        visitedBits.assign(static_cast<std::size_t>(rowWords) * height, 0);
+    } else {
+        for (const Span &span : spans) {
+            BitVolume::Word *row = visitedBits.data() + span.y * rowWords;
+            for (int w = span.left / BitVolume::wordBits; w <= span.right / BitVolume::wordBits; w++) { row[w] = 0; }
+        }
+    }
+    spans.clear();
+    seeds.clear();
+    edgeReached = false;
+    bounds = QRect();
+}
+
+void FloodFill::visit(int y, int left, int right) {
+    BitVolume::Word *row = visitedBits.data() + y * rowWords;
+    for (int w = left / BitVolume::wordBits; w <= right / BitVolume::wordBits; w++) {
+        row[w] |= BitVolume::bitRange(std::max(0, left - w * BitVolume::wordBits),
+                                      std::min(BitVolume::wordBits - 1, right - w * BitVolume::wordBits));
+    }
+    spans.push_back({y, left, right});
+    edgeReached |= left == 0 || right == bitmapWidth - 1 || y == 0 || y == bitmapHeight - 1;
+    bounds |= QRect(QPoint(left, y), QPoint(right, y));
+}
@@ -0,0 +1,82 @@
+#ifndef FLOODFILL_H
+#define FLOODFILL_H
+
+#include <QPoint>
+#include <QRect>
+
+#include <vector>
+
+#include "bitvolume.h"
+
+// Scanline flood fill of 4-connected pixels: each row of the region is found as one span, and only the first
+// pixel of every run next to it above and below is pushed as a seed. The visited bitmap, the seed stack and
+// the spans are kept between fills, so a fill allocates only when it outgrows all the fills before it.
+class FloodFill {
+public:
+    struct Span {
+        int y;
+        int left;
+        int right;
+    };
+
+    // Spans of the pixels of a width x height image connected to seed for which inside(x, y) holds,
+    // none when seed itself is not inside. Valid until the next fill.
+    template<typename Inside>
+    const std::vector<Span> &fill(int width, int height, const QPoint &seed, Inside inside);
+
+    // Whether the last fill reached the edge of the image, so the region was not enclosed
+    bool reachedEdge() const { return edgeReached; }
+    QRect boundingRect() const { return bounds; }
+
+private:
+    // Forgets the previous fill, clearing only the bits it set unless the size changed
+    void start(int width, int height);
+    bool visited(int x, int y) const {
+        return (visitedBits[y * rowWords + x / BitVolume::wordBits] >> (x % BitVolume::wordBits)) & 1u;
+    }
+    void visit(int y, int left, int right);
+
+    int bitmapWidth = 0;
+    int bitmapHeight = 0;
+    int rowWords = 0;
+    std::vector<BitVolume::Word> visitedBits;
+    std::vector<QPoint> seeds;
+    std::vector<Span> spans;
+    bool edgeReached = false;
+    QRect bounds;
+};
+
+template<typename Inside>
+const std::vector<FloodFill::Span> &FloodFill::fill(int width, int height, const QPoint &seed, Inside inside) {
+    start(width, height);
+    if (seed.x() < 0 || seed.x() >= width || seed.y() < 0 || seed.y() >= height || !inside(seed.x(), seed.y())) {
+        return spans;
+    }
+
+    seeds.push_back(seed);
+    while (!seeds.empty()) {
+        const QPoint point = seeds.back();
+        seeds.pop_back();
+        const int y = point.y();
+        if (visited(point.x(), y)) { continue; } // reached through another seed meanwhile
+
+        int left = point.x();
+        int right = point.x();
+        while (left > 0 && inside(left - 1, y)) { left--; }
+        while (right < width - 1 && inside(right + 1, y)) { right++; }
+        visit(y, left, right);
+
+        for (const int next : {y - 1, y + 1}) {
+            if (next < 0 || next >= height) { continue; }
+            bool inRun = false;
+            for (int x = left; x <= right; x++) {
+                const bool fillable = !visited(x, next) && inside(x, next);
+                if (fillable && !inRun) { seeds.emplace_back(x, next); }
+                inRun = fillable;
+            }
+        }
+    }
+    return spans;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "imageview.h"
+
+#include <QPaintEvent>
+#include <QPainter>
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const int tileCacheMB = 64;
+
+// Source pixel whose area covers the centre of target pixel
+inline int nearestSource(int target, int sourceSize, int targetSize) {
+    return static_cast<int>((2 * static_cast<qint64>(target) + 1) * sourceSize / (2 * static_cast<qint64>(targetSize)));
+}
+
+// Two source pixels around the centre of a target pixel, weight (0-255) being the share of the second
+struct Sample {
+    int first;
+    int second;
+    uint weight;
+};
+
+inline Sample bilinearSource(int target, int sourceSize, int targetSize) {
+    // centre of the target pixel in source pixels, 16.16 fixed point
+    const qint64 centre = ((2 * static_cast<qint64>(target) + 1) * sourceSize << 16) / (2 * static_cast<qint64>(targetSize))
+                          - (1 << 15);
+    if (centre <= 0) { return {0, 0, 0}; }
+    const int first = static_cast<int>(centre >> 16);
+    if (first >= sourceSize - 1) { return {sourceSize - 1, sourceSize - 1, 0}; }
+    return {first, first + 1, static_cast<uint>(centre & 0xffff) >> 8};
+}
+
+// Premultiplied pixels mixed channel by channel, two channels per multiplication
+inline quint32 mixPixels(quint32 first, quint32 second, uint weight) {
+    const uint inverse = 256 - weight;
+    const quint32 redBlue = ((first & 0xff00ffu) * inverse + (second & 0xff00ffu) * weight) >> 8;
+    const quint32 alphaGreen = ((first >> 8) & 0xff00ffu) * inverse + ((second >> 8) & 0xff00ffu) * weight;
+    return (redBlue & 0xff00ffu) | (alphaGreen & 0xff00ff00u);
+}
+
+}
+
+ImageView::ImageView(QWidget *parent) : QWidget(parent), tiles(tileCacheMB * 1024) {
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void ImageView::setImage(const QImage &image) {
+    frameBuffer = image;
+    tiles.clear();
+    updateGeometry();
+    update();
+}
+
+void ImageView::updateImageRect(const QRect &rect) {
+    if (frameBuffer.isNull() || rect.isEmpty() || width() == 0 || height() == 0) { return; }
+
+    // widget pixels sampling the changed ones, with a margin for the neighbours of bilinear samples
+    const QRect source = rect.adjusted(-1, -1, 1, 1);
+    const QRect widgetRect = QRect(QPoint(static_cast<int>(static_cast<qint64>(source.left()) * width() / frameBuffer.width()),
+                                          static_cast<int>(static_cast<qint64>(source.top()) * height() / frameBuffer.height())),
+                                   QPoint(static_cast<int>(static_cast<qint64>(source.right() + 1) * width() / frameBuffer.width()),
+                                          static_cast<int>(static_cast<qint64>(source.bottom() + 1) * height() / frameBuffer.height())))
+            .intersected(QWidget::rect());
+
+    // visible tiles are brought up to date in place, the others are dropped and rendered again when exposed
+    const QRect visible = visibleRegion().boundingRect();
+    for (int ty = widgetRect.top() / tileSize; ty <= widgetRect.bottom() / tileSize; ty++) {
+        for (int tx = widgetRect.left() / tileSize; tx <= widgetRect.right() / tileSize; tx++) {
+            const quint32 key = static_cast<quint32>(ty) << 16 | static_cast<quint32>(tx);
+            QImage *tile = tiles.object(key);
+            if (tile == nullptr) { continue; }
+            const QRect tileRect(QPoint(tx * tileSize, ty * tileSize), tile->size());
+            if (tileRect.intersects(visible)) {
+                renderTile(*tile, tileRect.topLeft(), widgetRect.intersected(tileRect));
+            } else {
+                tiles.remove(key);
+            }
+        }
+    }
+    update(widgetRect);
+}
+
+void ImageView::setResampling(Resampling resampling) {
+    if (resampling == resamplingMode) { return; }
+    resamplingMode = resampling;
+    tiles.clear();
+    update();
+}
+
+void ImageView::resizeEvent(QResizeEvent *event) {
+    tiles.clear(); // rendered for the old scale
+    QWidget::resizeEvent(event);
+}
+
+void ImageView::paintEvent(QPaintEvent *event) {
+    QPainter painter(this);
+    const QRect exposed = event->rect();
+    if (frameBuffer.isNull()) {
+        painter.fillRect(exposed, palette().base());
+        return;
+    }
+
+    for (int ty = exposed.top() / tileSize; ty <= exposed.bottom() / tileSize; ty++) {
+        for (int tx = exposed.left() / tileSize; tx <= exposed.right() / tileSize; tx++) {
+            const quint32 key = static_cast<quint32>(ty) << 16 | static_cast<quint32>(tx);
+            const QPoint origin(tx * tileSize, ty * tileSize);
+            const QImage *cached = tiles.object(key);
+            QImage tile = cached != nullptr ? *cached : QImage();
+            if (tile.isNull()) {
+                const QRect tileRect = QRect(origin, QSize(tileSize, tileSize)).intersected(rect());
+                tile = QImage(tileRect.size(), QImage::Format_ARGB32_Premultiplied);
+                renderTile(tile, origin, tileRect);
+                tiles.insert(key, new QImage(tile), static_cast<int>((tile.sizeInBytes() + 1023) / 1024));
+            }
+            painter.drawImage(origin, tile);
+        }
+    }
+}
+
+void ImageView::renderTile(QImage &tile, const QPoint &origin, const QRect &part) const {
+    const int sourceWidth = frameBuffer.width();
+    const int sourceHeight = frameBuffer.height();
+    const int partWidth = part.width();
+
+    if (resamplingMode == Nearest) {
+        std::vector<int> columns(partWidth);
+        for (int x = 0; x < partWidth; x++) { columns[x] = nearestSource(part.left() + x, sourceWidth, width()); }
+
+        int previousRow = -1;
+        for (int y = part.top(); y <= part.bottom(); y++) {
+            auto *dst = reinterpret_cast<quint32 *>(tile.scanLine(y - origin.y())) + part.left() - origin.x();
+            const int row = nearestSource(y, sourceHeight, height());
+            if (row == previousRow) {
+                // zoomed in, the row above came from the same source row
+                std::memcpy(dst, reinterpret_cast<const quint32 *>(tile.constScanLine(y - 1 - origin.y())) + part.left() - origin.x(),
+                            partWidth * sizeof(quint32));
+                continue;
+            }
+            const auto *src = reinterpret_cast<const quint32 *>(frameBuffer.constScanLine(row));
+            for (int x = 0; x < partWidth; x++) { dst[x] = src[columns[x]]; }
+            previousRow = row;
+        }
+        return;
+    }
+
+    std::vector<Sample> columns(partWidth);
+    for (int x = 0; x < partWidth; x++) { columns[x] = bilinearSource(part.left() + x, sourceWidth, width()); }
+
+    for (int y = part.top(); y <= part.bottom(); y++) {
+        auto *dst = reinterpret_cast<quint32 *>(tile.scanLine(y - origin.y())) + part.left() - origin.x();
+        const Sample row = bilinearSource(y, sourceHeight, height());
+        const auto *top = reinterpret_cast<const quint32 *>(frameBuffer.constScanLine(row.first));
+        const auto *bottom = reinterpret_cast<const quint32 *>(frameBuffer.constScanLine(row.second));
+        for (int x = 0; x < partWidth; x++) {
+            const Sample &column = columns[x];
+            dst[x] = mixPixels(mixPixels(top[column.first], top[column.second], column.weight),
+                               mixPixels(bottom[column.first], bottom[column.second], column.weight), row.weight);
+        }
+    }
+}
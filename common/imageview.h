@@ -0,0 +1,46 @@
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+#include <QCache>
+#include <QImage>
+#include <QWidget>
+
+// Widget showing a framebuffer stretched over the whole widget. Inside a scroll area only the visible part
+// is resampled: the stretched image is cut into tiles of widget pixels, rendered when first exposed and kept
+// while the size stays the same, so zooming and panning cost the same at any zoom.
+// After changing a part of the image only the matching part of the tiles and of the widget is redrawn.
+class ImageView : public QWidget {
+public:
+    enum Resampling { Nearest, Bilinear };
+
+    explicit ImageView(QWidget *parent = nullptr);
+
+    // Drawn into in place, an image shared through setImage is detached by the first write
+    QImage &image() { return frameBuffer; }
+    const QImage &image() const { return frameBuffer; }
+    void setImage(const QImage &image);
+
+    // Repaints the part of the widget showing rect, given in image pixels
+    void updateImageRect(const QRect &rect);
+
+    void setResampling(Resampling resampling);
+    Resampling resampling() const { return resamplingMode; }
+
+    QSize sizeHint() const override { return frameBuffer.size(); }
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    static const int tileSize = 128;
+
+    // Resamples part (widget pixels) of the tile whose top left corner is at origin
+    void renderTile(QImage &tile, const QPoint &origin, const QRect &part) const;
+
+    QImage frameBuffer;
+    Resampling resamplingMode = Nearest;
+    QCache<quint32, QImage> tiles; // keyed by tile row and column, costs in KB
+};
+
+#endif
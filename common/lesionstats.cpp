@@ -0,0 +1,158 @@
+#include "lesionstats.h"
+
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+struct Run {
+    int left;
+    int right;
+    int label;
+};
+
+int findRoot(std::vector<int> &parents, int label) {
+    while (parents[label] != label) {
+        parents[label] = parents[parents[label]];
+        label = parents[label];
+    }
+    return label;
+}
+
+// Merges the labels of run with those of the runs of another row it overlaps, the rows are sorted left to right
+void mergeOverlapping(const Run &run, const Run *&others, const Run *othersEnd, std::vector<int> &parents) {
+    while (others != othersEnd && others->right < run.left) { others++; }
+    for (const Run *other = others; other != othersEnd && other->left <= run.right; other++) {
+        const int root = findRoot(parents, run.label);
+        const int otherRoot = findRoot(parents, other->label);
+        if (root != otherRoot) { parents[std::max(root, otherRoot)] = std::min(root, otherRoot); }
+    }
+}
+
+}
+
+LesionStats::LesionStats(const BitVolume *mask, QObject *parent) : QObject(parent), mask(mask) {
+    pool.setMaxThreadCount(1);
+    recountTimer.setSingleShot(true);
+    recountTimer.setInterval(recountDelayMs);
+    connect(&recountTimer, &QTimer::timeout, this, &LesionStats::recount);
+}
+
+LesionStats::~LesionStats() {
+    pool.waitForDone();
+}
+
+void LesionStats::reset() {
+    voxelsPerSlice.assign(mask->slices(), 0);
+    voxelsTotal = 0;
+    slicesAnnotated = 0;
+    for (int sl_no = 0; sl_no < mask->slices(); sl_no++) {
+        voxelsPerSlice[sl_no] = static_cast<int>(mask->countSlice(sl_no));
+        voxelsTotal += voxelsPerSlice[sl_no];
+        if (voxelsPerSlice[sl_no] > 0) { slicesAnnotated++; }
+    }
+    // a count still running keeps the snapshot it was started on
+    snapshot = std::make_shared<BitVolume>(mask->width(), mask->height(), mask->slices());
+    changedSlices.assign(mask->slices(), 1);
+    lesionsNo = -1;
+    generation++;
+    if (countingEnabled) { recountTimer.start(); }
+}
+
+void LesionStats::add(int slice, int voxels) {
+    changedSlices[slice] = 1; // set and cleared voxels may cancel out, the lesions can still change
+    const bool wasAnnotated = voxelsPerSlice[slice] > 0;
+    voxelsPerSlice[slice] += voxels;
+    voxelsTotal += voxels;
+    slicesAnnotated += (voxelsPerSlice[slice] > 0) - wasAnnotated;
+    lesionsNo = -1;
+    generation++;
+    if (countingEnabled) { recountTimer.start(); } // restarted by every edit, so a stroke is counted once
+}
+
+void LesionStats::setEnabled(bool enabled) {
+    countingEnabled = enabled;
+    if (!enabled) {
+        recountTimer.stop();
+    } else if (lesionsNo < 0) {
+        recount();
+    }
+}
+
+void LesionStats::recount() {
+    recountTimer.stop();
+    if (mask->isEmpty() || counting) { return; } // a count still running restarts the timer once done
+
+    // only the slices edited since the last count are copied, the mask keeps changing while the worker counts
+    for (int sl_no = 0; sl_no < mask->slices(); sl_no++) {
+        if (!changedSlices[sl_no]) { continue; }
+        std::copy_n(mask->slice(sl_no), mask->sliceWords(), snapshot->slice(sl_no));
+        changedSlices[sl_no] = 0;
+    }
+
+    counting = true;
+    auto *watcher = new QFutureWatcher<int>(this);
+    connect(watcher, &QFutureWatcher<int>::finished, this, [this, watcher, started = generation]() {
+        watcher->deleteLater();
+        counting = false;
+        if (started != generation) {
+            if (countingEnabled) { recountTimer.start(); }
+            return;
+        }
+        lesionsNo = watcher->result();
+        emit lesionsCounted();
+    });
+    watcher->setFuture(QtConcurrent::run(&pool, [counted = snapshot]() { return countLesions(*counted); }));
+}
+
+int LesionStats::countLesions(const BitVolume &mask) {
+    // Every run of set bits gets a label, labels of overlapping runs of the row above and of the same row
+    // of the previous slice are merged. Only the runs of two slices are kept.
+    std::vector<int> parents;
+    std::vector<Run> sliceRuns, previousSliceRuns;
+    std::vector<std::size_t> rowStarts(mask.height() + 1), previousRowStarts(mask.height() + 1, 0);
+
+    for (int sl_no = 0; sl_no < mask.slices(); sl_no++) {
+        sliceRuns.clear();
+        for (int y = 0; y < mask.height(); y++) {
+            rowStarts[y] = sliceRuns.size();
+            const BitVolume::Word *row = mask.row(sl_no, y);
+            for (int w = 0; w < mask.wordsPerRow(); w++) {
+                BitVolume::Word bits = row[w];
+                while (bits != 0) {
+                    const int first = BitVolume::lowestBit(bits);
+                    const BitVolume::Word beyondRun = ~(bits >> first);
+                    const int length = beyondRun == 0 ? BitVolume::wordBits - first : BitVolume::lowestBit(beyondRun);
+                    const int left = w * BitVolume::wordBits + first;
+                    if (sliceRuns.size() > rowStarts[y] && sliceRuns.back().right + 1 == left) {
+                        sliceRuns.back().right = left + length - 1; // continued from the previous word
+                    } else {
+                        sliceRuns.push_back({left, left + length - 1, static_cast<int>(parents.size())});
+                        parents.push_back(static_cast<int>(parents.size()));
+                    }
+                    if (first + length == BitVolume::wordBits) { break; }
+                    bits &= ~BitVolume::Word(0) << (first + length);
+                }
+            }
+            rowStarts[y + 1] = sliceRuns.size();
+
+            const Run *above = y > 0 ? sliceRuns.data() + rowStarts[y - 1] : nullptr;
+            const Run *below = previousSliceRuns.data() + previousRowStarts[y];
+            for (std::size_t i = rowStarts[y]; i < rowStarts[y + 1]; i++) {
+                if (above != nullptr) { mergeOverlapping(sliceRuns[i], above, sliceRuns.data() + rowStarts[y], parents); }
+                mergeOverlapping(sliceRuns[i], below, previousSliceRuns.data() + previousRowStarts[y + 1], parents);
+            }
+        }
+        std::swap(sliceRuns, previousSliceRuns);
+        std::swap(rowStarts, previousRowStarts);
+    }
+
+    int lesions = 0;
+    for (std::size_t label = 0; label < parents.size(); label++) {
+        if (parents[label] == static_cast<int>(label)) { lesions++; }
+    }
+    return lesions;
+}
@@ -0,0 +1,64 @@
+#ifndef LESIONSTATS_H
+#define LESIONSTATS_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <memory>
+#include <vector>
+
+#include "bitvolume.h"
+
+// Lesion volume of a mask kept as per-slice voxel counts, updated by the edits as they change the mask.
+// The number of lesions (6-connected components in 3D) is recounted on a worker thread once the edits
+// pause, and only while enabled, as it needs a pass over the whole mask.
+class LesionStats : public QObject
+{
+Q_OBJECT
+
+public:
+    static const int recountDelayMs = 500;
+
+    // mask is read on the GUI thread only, the worker counts a snapshot of it
+    explicit LesionStats(const BitVolume *mask, QObject *parent = nullptr);
+    ~LesionStats() override;
+
+    // Counts every slice of the mask, after it was replaced
+    void reset();
+    // slice changed by an edit, voxels set (or cleared, when negative) in it
+    void add(int slice, int voxels);
+
+    int sliceVoxels(int slice) const { return voxelsPerSlice[slice]; }
+    qint64 totalVoxels() const { return voxelsTotal; }
+    int annotatedSlices() const { return slicesAnnotated; }
+    // -1 until the lesions of the current mask have been counted
+    int lesions() const { return lesionsNo; }
+
+    void setEnabled(bool enabled);
+
+    // 6-connected components of mask, runs of set bits are merged slice by slice
+    static int countLesions(const BitVolume &mask);
+
+signals:
+    void lesionsCounted();
+
+private:
+    void recount();
+
+    const BitVolume *mask;
+    std::vector<int> voxelsPerSlice;
+    qint64 voxelsTotal = 0;
+    int slicesAnnotated = 0;
+    int lesionsNo = -1;
+    bool countingEnabled = false;
+    int generation = 0; // counts started before the mask last changed are dropped
+    bool counting = false;
+    // copy of the mask owned by the running count, the changed slices are refreshed before the next one
+    std::shared_ptr<BitVolume> snapshot;
+    std::vector<char> changedSlices;
+    QThreadPool pool;
+    QTimer recountTimer;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include "rawdecode.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpufeatures.h"
+
+namespace {
+
+typedef BitVolume::Word Word;
+
+struct Kernels {
+    unsigned short (*decodeMax16)(const unsigned char *, unsigned short *, std::size_t);
+    void (*rescale16)(unsigned short *, std::size_t, float);
+    void (*threshold16)(const unsigned char *, Word *, int);
+    void (*mask8)(const unsigned char *, Word *, int);
+    void (*corrections8)(const unsigned char *, Word *, Word *, int);
+    const char *name;
+};
+
+// Scalar variants, also used for the tails of the vectorized ones
+
+unsigned short decodeMax16Scalar(const unsigned char *src, unsigned short *dst, std::size_t n) {
+    unsigned short maxVal {};
+    for (std::size_t i = 0; i < n; i++, src += 2) {
+        dst[i] = static_cast<unsigned short>(src[0] << 8 | src[1]);
+        maxVal = std::max(maxVal, dst[i]);
+    }
+    return maxVal;
+}
+
+// rounding matches the vector conversions (to nearest, ties to even)
+void rescale16Scalar(unsigned short *data, std::size_t n, float scale) {
+    for (std::size_t i = 0; i < n; i++) {
+        data[i] = static_cast<unsigned short>(std::lrint(static_cast<float>(data[i]) * scale));
+    }
+}
+
+void threshold16Tail(const unsigned char *src, Word *row, int from, int width) {
+    for (int x = from; x < width; x += BitVolume::wordBits) {
+        Word bits {};
+        for (int b = 0; b < BitVolume::wordBits && x + b < width; b++) {
+            bits |= Word((src[2 * (x + b)] | src[2 * (x + b) + 1]) != 0) << b;
+        }
+        row[x / BitVolume::wordBits] = bits;
+    }
+}
+
+void mask8Tail(const unsigned char *src, Word *row, int from, int width) {
+    for (int x = from; x < width; x += BitVolume::wordBits) {
+        Word bits {};
+        for (int b = 0; b < BitVolume::wordBits && x + b < width; b++) {
+            bits |= Word(src[x + b] != 0) << b;
+        }
+        row[x / BitVolume::wordBits] = bits;
+    }
+}
+
+void corrections8Tail(const unsigned char *src, Word *additionsRow, Word *removalsRow, int from, int width) {
+    for (int x = from; x < width; x += BitVolume::wordBits) {
+        Word additions {}, removals {};
+        for (int b = 0; b < BitVolume::wordBits && x + b < width; b++) {
+            additions |= Word(src[x + b] == 1) << b;
+            removals |= Word(src[x + b] == 0xFF) << b;
+        }
+        additionsRow[x / BitVolume::wordBits] = additions;
+        removalsRow[x / BitVolume::wordBits] = removals;
+    }
+}
+
+void threshold16Scalar(const unsigned char *src, Word *row, int width) { threshold16Tail(src, row, 0, width); }
+void mask8Scalar(const unsigned char *src, Word *row, int width) { mask8Tail(src, row, 0, width); }
+void corrections8Scalar(const unsigned char *src, Word *additionsRow, Word *removalsRow, int width) {
+    corrections8Tail(src, additionsRow, removalsRow, 0, width);
+}
+
+#ifdef CPU_X86
+
+// SSE2 - 8 values of 16 bits or 16 values of 8 bits per instruction
+
+unsigned short decodeMax16Sse2(const unsigned char *src, unsigned short *dst, std::size_t n) {
+    // SSE2 only has a signed 16-bit max, flipping the sign bit keeps the order of unsigned values
+    const __m128i signBit = _mm_set1_epi16(-0x8000);
+    __m128i maxVec = signBit;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+        const __m128i swapped = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), swapped);
+        maxVec = _mm_max_epi16(maxVec, _mm_xor_si128(swapped, signBit));
+    }
+    alignas(16) unsigned short lanes[8];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), _mm_xor_si128(maxVec, signBit));
+    const unsigned short maxVal = *std::max_element(lanes, lanes + 8);
+    return std::max(maxVal, decodeMax16Scalar(src + 2 * i, dst + i, n - i));
+}
+
+// 32-bit results in 0..65535 packed back to 16 bits, shifted into the signed range so packs does not saturate
+inline __m128i packUnsigned32Sse2(__m128i low, __m128i high) {
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(-0x8000);
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(low, bias32), _mm_sub_epi32(high, bias32)), bias16);
+}
+
+void rescale16Sse2(unsigned short *data, std::size_t n, float scale) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scaleVec = _mm_set1_ps(scale);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i low = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scaleVec));
+        const __m128i high = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scaleVec));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), packUnsigned32Sse2(low, high));
+    }
+    rescale16Scalar(data + i, n - i, scale);
+}
+
+void threshold16Sse2(const unsigned char *src, Word *row, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + BitVolume::wordBits <= width; x += BitVolume::wordBits) {
+        Word bits {};
+        for (int part = 0; part < 4; part++) {
+            const unsigned char *block = src + 2 * (x + 16 * part);
+            const __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block)), zero);
+            const __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16)), zero);
+            const auto zeros = static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(low, high)));
+            bits |= Word(~zeros & 0xFFFFu) << (16 * part);
+        }
+        row[x / BitVolume::wordBits] = bits;
+    }
+    threshold16Tail(src, row, x, width);
+}
+
+void mask8Sse2(const unsigned char *src, Word *row, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + BitVolume::wordBits <= width; x += BitVolume::wordBits) {
+        Word bits {};
+        for (int part = 0; part < 4; part++) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 16 * part));
+            const auto zeros = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+            bits |= Word(~zeros & 0xFFFFu) << (16 * part);
+        }
+        row[x / BitVolume::wordBits] = bits;
+    }
+    mask8Tail(src, row, x, width);
+}
+
+void corrections8Sse2(const unsigned char *src, Word *additionsRow, Word *removalsRow, int width) {
+    const __m128i plusOne = _mm_set1_epi8(1);
+    const __m128i minusOne = _mm_set1_epi8(-1);
+    int x = 0;
+    for (; x + BitVolume::wordBits <= width; x += BitVolume::wordBits) {
+        Word additions {}, removals {};
+        for (int part = 0; part < 4; part++) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 16 * part));
+            additions |= Word(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, plusOne)))) << (16 * part);
+            removals |= Word(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, minusOne)))) << (16 * part);
+        }
+        additionsRow[x / BitVolume::wordBits] = additions;
+        removalsRow[x / BitVolume::wordBits] = removals;
+    }
+    corrections8Tail(src, additionsRow, removalsRow, x, width);
+}
+
+// AVX2 - twice the width of SSE2
+
+AVX2_TARGET unsigned short decodeMax16Avx2(const unsigned char *src, unsigned short *dst, std::size_t n) {
+    __m256i maxVec = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 2 * i));
+        const __m256i swapped = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), swapped);
+        maxVec = _mm256_max_epu16(maxVec, swapped);
+    }
+    alignas(32) unsigned short lanes[16];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), maxVec);
+    const unsigned short maxVal = *std::max_element(lanes, lanes + 16);
+    return std::max(maxVal, decodeMax16Scalar(src + 2 * i, dst + i, n - i));
+}
+
+AVX2_TARGET void rescale16Avx2(unsigned short *data, std::size_t n, float scale) {
+    const __m256 scaleVec = _mm256_set1_ps(scale);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i *block = reinterpret_cast<const __m128i *>(data + i);
+        const __m256i low = _mm256_cvtepu16_epi32(_mm_loadu_si128(block));
+        const __m256i high = _mm256_cvtepu16_epi32(_mm_loadu_si128(block + 1));
+        const __m256i lowScaled = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(low), scaleVec));
+        const __m256i highScaled = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(high), scaleVec));
+        // packus works per 128-bit lane, the permutation restores voxel order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lowScaled, highScaled), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), packed);
+    }
+    rescale16Scalar(data + i, n - i, scale);
+}
+
+AVX2_TARGET void threshold16Avx2(const unsigned char *src, Word *row, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + BitVolume::wordBits <= width; x += BitVolume::wordBits) {
+        Word bits {};
+        for (int part = 0; part < 2; part++) {
+            const unsigned char *block = src + 2 * (x + 32 * part);
+            const __m256i low = _mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block)), zero);
+            const __m256i high = _mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32)), zero);
+            // packs works per 128-bit lane, the permutation restores voxel order
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+            const auto zeros = static_cast<unsigned>(_mm256_movemask_epi8(packed));
+            bits |= Word(~zeros) << (32 * part);
+        }
+        row[x / BitVolume::wordBits] = bits;
+    }
+    threshold16Tail(src, row, x, width);
+}
+
+AVX2_TARGET void mask8Avx2(const unsigned char *src, Word *row, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + BitVolume::wordBits <= width; x += BitVolume::wordBits) {
+        Word bits {};
+        for (int part = 0; part < 2; part++) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x + 32 * part));
+            const auto zeros = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+            bits |= Word(~zeros) << (32 * part);
+        }
+        row[x / BitVolume::wordBits] = bits;
+    }
+    mask8Tail(src, row, x, width);
+}
+
+AVX2_TARGET void corrections8Avx2(const unsigned char *src, Word *additionsRow, Word *removalsRow, int width) {
+    const __m256i plusOne = _mm256_set1_epi8(1);
+    const __m256i minusOne = _mm256_set1_epi8(-1);
+    int x = 0;
+    for (; x + BitVolume::wordBits <= width; x += BitVolume::wordBits) {
+        Word additions {}, removals {};
+        for (int part = 0; part < 2; part++) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x + 32 * part));
+            additions |= Word(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, plusOne)))) << (32 * part);
+            removals |= Word(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, minusOne)))) << (32 * part);
+        }
+        additionsRow[x / BitVolume::wordBits] = additions;
+        removalsRow[x / BitVolume::wordBits] = removals;
+    }
+    corrections8Tail(src, additionsRow, removalsRow, x, width);
+}
+
+#endif
+
+Kernels selectKernels() {
+#ifdef CPU_X86
+    if (cpuHasAvx2()) {
+        return {decodeMax16Avx2, rescale16Avx2, threshold16Avx2, mask8Avx2, corrections8Avx2, "avx2"};
+    }
+    if (cpuHasSse2()) {
+        return {decodeMax16Sse2, rescale16Sse2, threshold16Sse2, mask8Sse2, corrections8Sse2, "sse2"};
+    }
+#endif
+    return {decodeMax16Scalar, rescale16Scalar, threshold16Scalar, mask8Scalar, corrections8Scalar, "scalar"};
+}
+
+const Kernels &kernels() {
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+}
+
+unsigned short decodeBigEndian16Max(const unsigned char *src, unsigned short *dst, std::size_t n) {
+    return kernels().decodeMax16(src, dst, n);
+}
+
+void rescaleTo16Bit(unsigned short *data, std::size_t n, unsigned short maxVal) {
+    if (maxVal == 0 || maxVal == 65535) { return; }
+    kernels().rescale16(data, n, 65535.0f / maxVal);
+}
+
+void thresholdBigEndian16(const unsigned char *src, BitVolume::Word *row, int width) {
+    kernels().threshold16(src, row, width);
+}
+
+void packMask8(const unsigned char *src, BitVolume::Word *row, int width) {
+    kernels().mask8(src, row, width);
+}
+
+void packCorrections8(const unsigned char *src, BitVolume::Word *additionsRow, BitVolume::Word *removalsRow, int width) {
+    kernels().corrections8(src, additionsRow, removalsRow, width);
+}
+
+const char *decodeKernelName() {
+    return kernels().name;
+}
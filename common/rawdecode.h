@@ -0,0 +1,25 @@
+#ifndef RAWDECODE_H
+#define RAWDECODE_H
+
+#include <cstddef>
+
+#include "bitvolume.h"
+
+// Decode kernels for .raw payloads. Each one has a scalar, SSE2 and AVX2 variant,
+// the fastest one supported by the CPU is picked on first use.
+
+// n big endian 16-bit values to host order, returns the largest decoded value
+unsigned short decodeBigEndian16Max(const unsigned char *src, unsigned short *dst, std::size_t n);
+// n values scaled in place by 65535 / maxVal and rounded to the nearest integer
+void rescaleTo16Bit(unsigned short *data, std::size_t n, unsigned short maxVal);
+// width big endian 16-bit values to one bit row, set where the value is non-zero
+void thresholdBigEndian16(const unsigned char *src, BitVolume::Word *row, int width);
+// width 8-bit values to one bit row, set where the value is non-zero
+void packMask8(const unsigned char *src, BitVolume::Word *row, int width);
+// width 8-bit manual corrections to bit rows of values equal to 1 and values equal to -1
+void packCorrections8(const unsigned char *src, BitVolume::Word *additionsRow, BitVolume::Word *removalsRow, int width);
+
+// Name of the kernel set in use ("scalar", "sse2" or "avx2")
+const char *decodeKernelName();
+
+#endif
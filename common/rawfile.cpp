@@ -0,0 +1,155 @@
+#include "rawfile.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+
+#include "rawdecode.h"
+
+namespace {
+
+// 16-bit volume file with the dimensions of dataArray
+bool open16(VolumeFile &volumeFile, const QString &fileName, const Volume<unsigned short> &dataArray,
+            RawFile::Mode mode = RawFile::ReadOnly) {
+    const VolumeInfo layout = VolumeInfo(VolumeInfo::UInt16, dataArray.width(), dataArray.height(), dataArray.slices());
+    return volumeFile.open(fileName, layout, mode) && volumeFile.info().sameLayout(layout);
+}
+
+// 8-bit volume file, signed or not
+bool open8(VolumeFile &volumeFile, const QString &fileName, int width, int height, int slices,
+           RawFile::Mode mode = RawFile::ReadOnly) {
+    if (!volumeFile.open(fileName, VolumeInfo(VolumeInfo::UInt8, width, height, slices), mode)) { return false; }
+    const VolumeInfo &info = volumeFile.info();
+    return info.bytesPerVoxel() == 1 && info.width == width && info.height == height && info.slices == slices;
+}
+
+// One slice of a 16-bit volume file in host byte order, returns its largest value
+unsigned short decodeSlice16(const VolumeFile &volumeFile, int slice, unsigned short *dst) {
+    const std::size_t sliceSize = static_cast<std::size_t>(volumeFile.info().width) * volumeFile.info().height;
+    if (volumeFile.info().bigEndian) { return decodeBigEndian16Max(volumeFile.slice(slice), dst, sliceSize); }
+
+    qFromLittleEndian<quint16>(volumeFile.slice(slice), static_cast<qsizetype>(sliceSize), dst);
+    return sliceSize > 0 ? *std::max_element(dst, dst + sliceSize) : 0;
+}
+
+}
+
+bool LazyMaskVolume::open(const QString &fileName, int width, int height, int slices) {
+    close();
+    const VolumeInfo layout = VolumeInfo(VolumeInfo::UInt16, width, height, slices);
+    if (!volumeFile.open(fileName, layout) || !volumeFile.info().sameLayout(layout)) {
+        volumeFile.close();
+        return false;
+    }
+    bits = BitVolume(width, height, slices);
+    decoded.assign(slices, 0);
+    return true;
+}
+
+void LazyMaskVolume::close() {
+    volumeFile.close();
+    bits = BitVolume();
+    decoded.clear();
+}
+
+void LazyMaskVolume::decodeSlice(int slice) {
+    // only non-zero matters, so the byte order of the file does not
+    const int width = bits.width();
+    const uchar *currByte = volumeFile.slice(slice);
+    for (int y = 0; y < bits.height(); y++, currByte += 2 * width) {
+        thresholdBigEndian16(currByte, bits.row(slice, y), width);
+    }
+    decoded[slice] = 1;
+}
+
+bool loadRawRescaled(const QString &fileName, Volume<unsigned short> &dataArray) {
+    VolumeFile volumeFile;
+    if (!open16(volumeFile, fileName, dataArray)) { return false; }
+
+    std::vector<int> sliceNumbers(dataArray.slices());
+    std::iota(sliceNumbers.begin(), sliceNumbers.end(), 0);
+    std::vector<unsigned short> sliceMax(dataArray.slices());
+
+    QtConcurrent::blockingMap(sliceNumbers, [&](int sl_no) {
+        sliceMax[sl_no] = decodeSlice16(volumeFile, sl_no, dataArray.slice(sl_no));
+    });
+    if (sliceMax.empty()) { return true; }
+
+    const unsigned short maxVal = *std::max_element(sliceMax.begin(), sliceMax.end());
+    QtConcurrent::blockingMap(sliceNumbers, [&](int sl_no) {
+        rescaleTo16Bit(dataArray.slice(sl_no), dataArray.sliceSize(), maxVal);
+    });
+    return true;
+}
+
+bool loadRaw(const QString &fileName, BitVolume &dataArray, int firstSlice, int slicesNo) {
+    VolumeFile volumeFile;
+    if (slicesNo < 0) { slicesNo = dataArray.slices() - firstSlice; }
+    if (!open8(volumeFile, fileName, dataArray.width(), dataArray.height(), slicesNo)) { return false; }
+
+    for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+        const uchar *currByte = volumeFile.slice(sl_no);
+        for (int y = 0; y < dataArray.height(); y++, currByte += dataArray.width()) {
+            packMask8(currByte, dataArray.row(firstSlice + sl_no, y), dataArray.width());
+        }
+    }
+    return true;
+}
+
+bool loadCorrectionsRaw(const QString &fileName, BitVolume &additions, BitVolume &removals,
+                        int firstSlice, int slicesNo) {
+    VolumeFile volumeFile;
+    if (slicesNo < 0) { slicesNo = additions.slices() - firstSlice; }
+    if (!open8(volumeFile, fileName, additions.width(), additions.height(), slicesNo)) { return false; }
+
+    for (int sl_no = 0; sl_no < slicesNo; sl_no++) {
+        const uchar *currByte = volumeFile.slice(sl_no);
+        for (int y = 0; y < additions.height(); y++, currByte += additions.width()) {
+            packCorrections8(currByte, additions.row(firstSlice + sl_no, y), removals.row(firstSlice + sl_no, y),
+                             additions.width());
+        }
+    }
+    return true;
+}
+
+bool mapRaw(const QString &fileName, int width, int height, int slices, Volume<char> &dataArray) {
+    auto volumeFile = std::make_shared<VolumeFile>();
+    if (!open8(*volumeFile, fileName, width, height, slices, RawFile::CopyOnWrite)) { return false; }
+
+    if (volumeFile->isContiguous()) {
+        auto *data = reinterpret_cast<char *>(volumeFile->writableSlice(0));
+        dataArray = Volume<char>(data, width, height, slices, volumeFile);
+        return true;
+    }
+    dataArray = Volume<char>(width, height, slices);
+    for (int sl_no = 0; sl_no < slices; sl_no++) {
+        std::memcpy(dataArray.slice(sl_no), volumeFile->slice(sl_no), dataArray.sliceSize());
+    }
+    return true;
+}
+
+bool mapRaw(const QString &fileName, int width, int height, int slices, Volume<unsigned short> &dataArray) {
+    auto volumeFile = std::make_shared<VolumeFile>();
+    const VolumeInfo layout = VolumeInfo(VolumeInfo::UInt16, width, height, slices);
+    if (!volumeFile->open(fileName, layout, RawFile::CopyOnWrite) || !volumeFile->info().sameLayout(layout)) {
+        return false;
+    }
+
+    const bool hostOrder = volumeFile->info().bigEndian == (Q_BYTE_ORDER == Q_BIG_ENDIAN);
+    const bool aligned = reinterpret_cast<std::uintptr_t>(volumeFile->slice(0)) % alignof(unsigned short) == 0;
+    if (volumeFile->isContiguous() && hostOrder && aligned) {
+        auto *data = reinterpret_cast<unsigned short *>(volumeFile->writableSlice(0));
+        dataArray = Volume<unsigned short>(data, width, height, slices, volumeFile);
+        return true;
+    }
+    dataArray = Volume<unsigned short>(width, height, slices);
+    for (int sl_no = 0; sl_no < slices; sl_no++) {
+        decodeSlice16(*volumeFile, sl_no, dataArray.slice(sl_no));
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef RAWFILE_H
+#define RAWFILE_H
+
+#include <QString>
+
+#include <vector>
+
+#include "bitvolume.h"
+#include "volume.h"
+#include "volumefile.h"
+
+// Binary mask backed by a mapped file with 16-bit voxels (superpixel grids),
+// each slice is thresholded into bits the first time it is accessed
+class LazyMaskVolume {
+public:
+    bool open(const QString &fileName, int width, int height, int slices);
+    void close();
+
+    const BitVolume::Word *row(int slice, int y) {
+        decode(slice);
+        return bits.row(slice, y);
+    }
+    // Once decoded, a slice may be read from other threads
+    void decode(int slice) {
+        if (!decoded[slice]) { decodeSlice(slice); }
+    }
+    bool test(int slice, int x, int y) {
+        return (row(slice, y)[x / BitVolume::wordBits] >> (x % BitVolume::wordBits)) & 1u;
+    }
+    int wordsPerRow() const { return bits.wordsPerRow(); }
+    bool isOpen() const { return volumeFile.isOpen(); }
+
+private:
+    void decodeSlice(int slice);
+
+    VolumeFile volumeFile;
+    BitVolume bits;
+    std::vector<char> decoded;
+};
+
+// Loaders shared by the annotation tools, the volume passed in defines the expected dimensions.
+// Files with a volume header have to match them, legacy .raw files are read as big endian payloads.
+// 16-bit image stretched so that its brightest voxel becomes 65535 (STIR, comparison images),
+// slices are decoded in parallel with the maximum taken on the fly
+bool loadRawRescaled(const QString &fileName, Volume<unsigned short> &dataArray);
+// 8-bit mask, every non-zero voxel is set; the file fills slicesNo slices from firstSlice on (all remaining if -1)
+bool loadRaw(const QString &fileName, BitVolume &dataArray, int firstSlice = 0, int slicesNo = -1);
+// 8-bit manual corrections split into voxels equal to 1 and voxels equal to -1
+bool loadCorrectionsRaw(const QString &fileName, BitVolume &additions, BitVolume &removals,
+                        int firstSlice = 0, int slicesNo = -1);
+// Volumes used in place through a copy-on-write mapping, nothing is copied up front.
+// 16-bit payloads have to be stored contiguously in host byte order for that, others are decoded.
+// dataArray is replaced, memory is allocated only when the file has to be copied or decoded.
+bool mapRaw(const QString &fileName, int width, int height, int slices, Volume<char> &dataArray);
+bool mapRaw(const QString &fileName, int width, int height, int slices, Volume<unsigned short> &dataArray);
+
+#endif
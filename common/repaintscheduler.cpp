@@ -0,0 +1,59 @@
+#include "repaintscheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+const qint64 nsPerSecond = 1000000000;
+
+}
+
+RepaintScheduler::RepaintScheduler(QObject *parent) : QObject(parent) {
+    timer.setSingleShot(true);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, &RepaintScheduler::renderFrame);
+    setFrameRate(60);
+    clock.start();
+    lastFrameTime = -frameInterval;
+}
+
+void RepaintScheduler::setFrameRate(double framesPerSecond) {
+    frameInterval = static_cast<qint64>(nsPerSecond / (framesPerSecond > 0 ? framesPerSecond : 60));
+}
+
+void RepaintScheduler::schedule(const QRect &rect) {
+    if (rect.isEmpty()) { return; }
+    pending += rect;
+    if (firstEditTime < 0) { firstEditTime = clock.nsecsElapsed(); }
+    if (!timer.isActive()) {
+        // the first edit after a pause is drawn right away, the following ones wait for the next frame
+        const qint64 wait = std::max<qint64>(0, lastFrameTime + frameInterval - clock.nsecsElapsed());
+        timer.start(static_cast<int>((wait + 999999) / 1000000));
+    }
+}
+
+void RepaintScheduler::discard() {
+    timer.stop();
+    pending = QRegion();
+    firstEditTime = -1;
+}
+
+int RepaintScheduler::framesPerSecond() {
+    const qint64 now = clock.nsecsElapsed();
+    while (!frameTimes.empty() && frameTimes.front() <= now - nsPerSecond) { frameTimes.pop_front(); }
+    return static_cast<int>(frameTimes.size());
+}
+
+void RepaintScheduler::renderFrame() {
+    if (pending.isEmpty()) { return; }
+    const QRegion region = pending;
+    pending = QRegion();
+    emit render(region);
+
+    const qint64 now = clock.nsecsElapsed();
+    const double latencyMs = static_cast<double>(now - firstEditTime) / 1e6;
+    averageLatency = averageLatency == 0 ? latencyMs : 0.9 * averageLatency + 0.1 * latencyMs;
+    firstEditTime = -1;
+    lastFrameTime = now;
+    frameTimes.push_back(now);
+}
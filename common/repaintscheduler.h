@@ -0,0 +1,48 @@
+#ifndef REPAINTSCHEDULER_H
+#define REPAINTSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QRegion>
+#include <QTimer>
+
+#include <deque>
+
+// Coalesces the repaints of edits: changed rectangles are collected and handed to render()
+// at most once per display frame, however many edits come in meanwhile.
+// Keeps the rate of rendered frames and the time from an edit to its pixels being rendered.
+class RepaintScheduler : public QObject
+{
+Q_OBJECT
+
+public:
+    explicit RepaintScheduler(QObject *parent = nullptr);
+
+    void setFrameRate(double framesPerSecond);
+
+    void schedule(const QRect &rect);
+    // Pending rectangles have been rendered some other way (e.g. the whole slice was redrawn)
+    void discard();
+
+    // Frames rendered during the last second
+    int framesPerSecond();
+    // Average time from the first edit of a frame to the end of its rendering, in milliseconds
+    double latency() const { return averageLatency; }
+
+signals:
+    void render(const QRegion &region);
+
+private:
+    void renderFrame();
+
+    QTimer timer;
+    QElapsedTimer clock;
+    QRegion pending;
+    qint64 frameInterval; // ns
+    qint64 firstEditTime = -1;
+    qint64 lastFrameTime = 0;
+    std::deque<qint64> frameTimes;
+    double averageLatency = 0;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#include "slicecache.h"
+
+SliceCache::SliceCache(int budgetMB) {
+    setBudget(budgetMB);
+}
+
+void SliceCache::setBudget(int budgetMB) {
+    cache.setMaxCost(budgetMB * 1024);
+}
+
+QImage SliceCache::find(const Key &key) {
+    const QImage *image = cache.object(key);
+    if (image == nullptr) {
+        missCount++;
+        return QImage();
+    }
+    hitCount++;
+    return *image;
+}
+
+void SliceCache::insert(const Key &key, const QImage &image) {
+    const int cost = static_cast<int>((image.sizeInBytes() + 1023) / 1024);
+    cache.insert(key, new QImage(image), cost); // shares the pixels, too large images are not kept
+}
@@ -0,0 +1,54 @@
+#ifndef SLICECACHE_H
+#define SLICECACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+
+struct SliceKey {
+    int layer;
+    int slice;
+    int variant; // display settings the layer was rendered with
+};
+
+inline bool operator==(const SliceKey &a, const SliceKey &b) {
+    return a.layer == b.layer && a.slice == b.slice && a.variant == b.variant;
+}
+
+inline uint qHash(const SliceKey &key, uint seed = 0) {
+    return qHash((static_cast<quint64>(key.layer) << 48) ^ (static_cast<quint64>(key.variant) << 32)
+                 ^ static_cast<quint32>(key.slice), seed);
+}
+
+// Rendered layers of whole slices, least recently used ones are dropped once their pixels exceed the budget.
+// Only the layers that do not change with edits are kept (greyscale image with the grid, comparison images),
+// overlays are composed on top of them.
+class SliceCache {
+public:
+    typedef SliceKey Key;
+
+    static const int defaultBudgetMB = 256;
+
+    explicit SliceCache(int budgetMB = defaultBudgetMB);
+
+    void setBudget(int budgetMB);
+    int budget() const { return cache.maxCost() / 1024; }
+    // Pixel memory of the cached layers, in MB
+    double size() const { return cache.totalCost() / 1024.; }
+
+    // Null image when the layer is not cached, counts a hit or a miss
+    QImage find(const Key &key);
+    void insert(const Key &key, const QImage &image);
+    bool contains(const Key &key) const { return cache.contains(key); }
+    void clear() { cache.clear(); }
+
+    quint64 hits() const { return hitCount; }
+    quint64 misses() const { return missCount; }
+
+private:
+    QCache<Key, QImage> cache; // costs in KB
+    quint64 hitCount = 0;
+    quint64 missCount = 0;
+};
+
+#endif
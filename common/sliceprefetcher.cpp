@@ -0,0 +1,61 @@
+#include "sliceprefetcher.h"
+
+#include <QFutureWatcher>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+SlicePrefetcher::SlicePrefetcher(SliceCache *cache, QObject *parent) : QObject(parent), cache(cache) {
+    // half of the cores, the others are left to the GUI thread and to loading
+    pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+}
+
+SlicePrefetcher::~SlicePrefetcher() {
+    cancel();
+}
+
+void SlicePrefetcher::prefetch(int currSlice, int slicesNo, const std::vector<SliceKey> &layers,
+                               const Renderer &renderer) {
+    centerSlice = currSlice;
+    for (int step = 1; step <= sliceDistance; step++) {
+        for (const int slice : {currSlice + step, currSlice - step}) {
+            if (slice < 0 || slice >= slicesNo) { continue; }
+            for (SliceKey key : layers) {
+                key.slice = slice;
+                if (queued.contains(key) || cache->contains(key)) { continue; }
+                queued.insert(key);
+
+                auto *watcher = new QFutureWatcher<QImage>(this);
+                const int started = generation;
+                connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, key, started]() {
+                    watcher->deleteLater();
+                    if (started != generation) { return; }
+                    queued.remove(key);
+                    const QImage image = watcher->result();
+                    if (!image.isNull()) { cache->insert(key, image); }
+                });
+                const int distance = sliceDistance;
+                watcher->setFuture(QtConcurrent::run(&pool, [this, key, distance, renderer, started]() {
+                    // the view may have moved on while the task was queued
+                    if (started != generation || std::abs(key.slice - centerSlice) > distance) { return QImage(); }
+                    return renderer(key);
+                }));
+            }
+        }
+    }
+}
+
+void SlicePrefetcher::cancel() {
+    centerSlice = INT_MIN / 2;
+    pool.waitForDone();
+    generation++;
+    queued.clear();
+}
+
+void SlicePrefetcher::discard() {
+    generation++;
+    queued.clear();
+}
@@ -0,0 +1,48 @@
+#ifndef SLICEPREFETCHER_H
+#define SLICEPREFETCHER_H
+
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "slicecache.h"
+
+// Renders the slices around the displayed one on worker threads, so that stepping through the slices
+// finds them in the cache. Finished images are put into the cache on the GUI thread.
+class SlicePrefetcher : public QObject
+{
+Q_OBJECT
+
+public:
+    // Runs on a worker thread, may only read volumes that stay unchanged until cancel()
+    typedef std::function<QImage(const SliceKey &key)> Renderer;
+
+    explicit SlicePrefetcher(SliceCache *cache, QObject *parent = nullptr);
+    ~SlicePrefetcher() override;
+
+    void setDistance(int slices) { sliceDistance = slices; }
+    int distance() const { return sliceDistance; }
+
+    // Queues the layers of the slices up to distance() away from currSlice which are not cached yet,
+    // nearest first. Each of layers gives the layer and variant wanted for every slice.
+    // Queued layers of earlier calls which are out of the new range are skipped.
+    void prefetch(int currSlice, int slicesNo, const std::vector<SliceKey> &layers, const Renderer &renderer);
+    // Skips the queued layers and waits for the running ones, required before the volumes read by the renderer change
+    void cancel();
+    // Drops the layers queued or running so far without waiting, for when they are outdated but their volumes are not
+    void discard();
+
+private:
+    SliceCache *cache;
+    QThreadPool pool;
+    int sliceDistance = 3;
+    std::atomic<int> centerSlice {0};
+    std::atomic<int> generation {0}; // results of tasks started before the last cancel() or discard() are dropped
+    QSet<SliceKey> queued;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "slicerender.h"
+
+#include "cpufeatures.h"
+
+namespace {
+
+typedef BitVolume::Word Word;
+
+struct Kernels {
+    void (*grey16)(const unsigned short *, quint32 *, int);
+    void (*tintMask)(const Word *, quint32, quint32 *, int);
+    void (*paintMask)(const Word *, quint32, quint32 *, int);
+    const char *name;
+};
+
+// Scalar variants, also used for the tails of the vectorized ones
+
+inline quint32 greyPixel(unsigned short value) {
+    return 0xff000000u | (static_cast<quint32>(value) >> 8) * 0x010101u;
+}
+
+void grey16Tail(const unsigned short *src, quint32 *dst, int from, int width) {
+    for (int x = from; x < width; x++) { dst[x] = greyPixel(src[x]); }
+}
+
+void grey16Scalar(const unsigned short *src, quint32 *dst, int width) {
+    grey16Tail(src, dst, 0, width);
+}
+
+// Replaces every pixel from on whose bit is set with pixel(old value), empty words are skipped
+template<typename Pixel>
+void maskTail(const Word *mask, quint32 *dst, int from, int width, Pixel pixel) {
+    int x = from;
+    while (x < width) {
+        const Word bits = mask[x / BitVolume::wordBits] >> (x % BitVolume::wordBits);
+        if (bits == 0) {
+            x = (x / BitVolume::wordBits + 1) * BitVolume::wordBits;
+            continue;
+        }
+        x += BitVolume::lowestBit(bits);
+        if (x < width) { dst[x] = pixel(dst[x]); }
+        x++;
+    }
+}
+
+void tintMaskTail(const Word *mask, quint32 color, quint32 *dst, int from, int width) {
+    maskTail(mask, dst, from, width, [color](quint32 pixel) { return blendPixel(pixel, color); });
+}
+
+void paintMaskTail(const Word *mask, quint32 color, quint32 *dst, int from, int width) {
+    maskTail(mask, dst, from, width, [color](quint32) { return color; });
+}
+
+void tintMaskScalar(const Word *mask, quint32 color, quint32 *dst, int width) {
+    tintMaskTail(mask, color, dst, 0, width);
+}
+
+void paintMaskScalar(const Word *mask, quint32 color, quint32 *dst, int width) {
+    paintMaskTail(mask, color, dst, 0, width);
+}
+
+// Mask bits of the lanes pixels from x on, x being a multiple of lanes
+inline unsigned laneBits(const Word *mask, int x, int lanes) {
+    return static_cast<unsigned>(mask[x / BitVolume::wordBits] >> (x % BitVolume::wordBits)) & ((1u << lanes) - 1);
+}
+
+#ifdef CPU_X86
+
+// 8 pixels per step: the high byte of every value is repeated in blue, green and red next to an opaque alpha
+void grey16Sse2(const unsigned short *src, quint32 *dst, int width) {
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(0xff00));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i grey = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x)), 8);
+        const __m128i blueGreen = _mm_or_si128(grey, _mm_slli_epi16(grey, 8));
+        const __m128i redAlpha = _mm_or_si128(grey, alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_unpacklo_epi16(blueGreen, redAlpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 4), _mm_unpackhi_epi16(blueGreen, redAlpha));
+    }
+    grey16Tail(src, dst, x, width);
+}
+
+// Same rounding as blendPixel
+inline __m128i blendSse2(__m128i pixels, __m128i color, __m128i inverseAlpha) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), inverseAlpha), half);
+    __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), inverseAlpha), half);
+    low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+    return _mm_add_epi8(_mm_packus_epi16(low, high), color);
+}
+
+// Lanes whose pixel has its mask bit set
+inline __m128i laneSelectSse2(unsigned bits) {
+    const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), lanes), lanes);
+}
+
+void tintMaskSse2(const Word *mask, quint32 color, quint32 *dst, int width) {
+    const __m128i colorVec = _mm_set1_epi32(static_cast<int>(color));
+    const __m128i inverseAlpha = _mm_set1_epi16(static_cast<short>(255 - (color >> 24)));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        if (x % BitVolume::wordBits == 0 && mask[x / BitVolume::wordBits] == 0) {
+            x += BitVolume::wordBits - 4;
+            continue;
+        }
+        const unsigned bits = laneBits(mask, x, 4);
+        if (bits == 0) { continue; }
+        auto *curr = reinterpret_cast<__m128i *>(dst + x);
+        const __m128i pixels = _mm_loadu_si128(curr);
+        const __m128i select = laneSelectSse2(bits);
+        const __m128i tinted = blendSse2(pixels, colorVec, inverseAlpha);
+        _mm_storeu_si128(curr, _mm_or_si128(_mm_and_si128(select, tinted), _mm_andnot_si128(select, pixels)));
+    }
+    tintMaskTail(mask, color, dst, x, width);
+}
+
+void paintMaskSse2(const Word *mask, quint32 color, quint32 *dst, int width) {
+    const __m128i colorVec = _mm_set1_epi32(static_cast<int>(color));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        if (x % BitVolume::wordBits == 0 && mask[x / BitVolume::wordBits] == 0) {
+            x += BitVolume::wordBits - 4;
+            continue;
+        }
+        const unsigned bits = laneBits(mask, x, 4);
+        if (bits == 0) { continue; }
+        auto *curr = reinterpret_cast<__m128i *>(dst + x);
+        const __m128i select = laneSelectSse2(bits);
+        _mm_storeu_si128(curr, _mm_or_si128(_mm_and_si128(select, colorVec), _mm_andnot_si128(select, _mm_loadu_si128(curr))));
+    }
+    paintMaskTail(mask, color, dst, x, width);
+}
+
+// 16 pixels per step, the in-lane unpacks leave pixels 0-3 and 8-11 in one register, so the halves are swapped back
+AVX2_TARGET void grey16Avx2(const unsigned short *src, quint32 *dst, int width) {
+    const __m256i alpha = _mm256_set1_epi16(static_cast<short>(0xff00));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m256i grey = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x)), 8);
+        const __m256i blueGreen = _mm256_or_si256(grey, _mm256_slli_epi16(grey, 8));
+        const __m256i redAlpha = _mm256_or_si256(grey, alpha);
+        const __m256i low = _mm256_unpacklo_epi16(blueGreen, redAlpha);
+        const __m256i high = _mm256_unpackhi_epi16(blueGreen, redAlpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x + 8), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+    grey16Tail(src, dst, x, width);
+}
+
+AVX2_TARGET inline __m256i blendAvx2(__m256i pixels, __m256i color, __m256i inverseAlpha) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(128);
+    __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), inverseAlpha), half);
+    __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), inverseAlpha), half);
+    low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+    high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+    return _mm256_add_epi8(_mm256_packus_epi16(low, high), color);
+}
+
+AVX2_TARGET inline __m256i laneSelectAvx2(unsigned bits) {
+    const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lanes), lanes);
+}
+
+AVX2_TARGET void tintMaskAvx2(const Word *mask, quint32 color, quint32 *dst, int width) {
+    const __m256i colorVec = _mm256_set1_epi32(static_cast<int>(color));
+    const __m256i inverseAlpha = _mm256_set1_epi16(static_cast<short>(255 - (color >> 24)));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        if (x % BitVolume::wordBits == 0 && mask[x / BitVolume::wordBits] == 0) {
+            x += BitVolume::wordBits - 8;
+            continue;
+        }
+        const unsigned bits = laneBits(mask, x, 8);
+        if (bits == 0) { continue; }
+        auto *curr = reinterpret_cast<__m256i *>(dst + x);
+        const __m256i pixels = _mm256_loadu_si256(curr);
+        const __m256i tinted = blendAvx2(pixels, colorVec, inverseAlpha);
+        _mm256_storeu_si256(curr, _mm256_blendv_epi8(pixels, tinted, laneSelectAvx2(bits)));
+    }
+    tintMaskTail(mask, color, dst, x, width);
+}
+
+AVX2_TARGET void paintMaskAvx2(const Word *mask, quint32 color, quint32 *dst, int width) {
+    const __m256i colorVec = _mm256_set1_epi32(static_cast<int>(color));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        if (x % BitVolume::wordBits == 0 && mask[x / BitVolume::wordBits] == 0) {
+            x += BitVolume::wordBits - 8;
+            continue;
+        }
+        const unsigned bits = laneBits(mask, x, 8);
+        if (bits == 0) { continue; }
+        auto *curr = reinterpret_cast<__m256i *>(dst + x);
+        _mm256_storeu_si256(curr, _mm256_blendv_epi8(_mm256_loadu_si256(curr), colorVec, laneSelectAvx2(bits)));
+    }
+    paintMaskTail(mask, color, dst, x, width);
+}
+
+#endif
+
+Kernels selectKernels() {
+#ifdef CPU_X86
+    if (cpuHasAvx2()) { return {grey16Avx2, tintMaskAvx2, paintMaskAvx2, "avx2"}; }
+    if (cpuHasSse2()) { return {grey16Sse2, tintMaskSse2, paintMaskSse2, "sse2"}; }
+#endif
+    return {grey16Scalar, tintMaskScalar, paintMaskScalar, "scalar"};
+}
+
+const Kernels &kernels() {
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+}
+
+void renderGreyRow(const unsigned short *src, quint32 *dst, int width) {
+    kernels().grey16(src, dst, width);
+}
+
+void tintMaskRow(const BitVolume::Word *mask, quint32 color, quint32 *dst, int width) {
+    kernels().tintMask(mask, color, dst, width);
+}
+
+void paintMaskRow(const BitVolume::Word *mask, quint32 color, quint32 *dst, int width) {
+    kernels().paintMask(mask, color, dst, width);
+}
+
+const char *renderKernelName() {
+    return kernels().name;
+}
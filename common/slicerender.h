@@ -0,0 +1,32 @@
+#ifndef SLICERENDER_H
+#define SLICERENDER_H
+
+#include <QtGlobal>
+
+#include "bitvolume.h"
+
+// Render kernels writing the slice display straight into Format_ARGB32_Premultiplied scanlines.
+// Like the decode kernels they have a scalar, SSE2 and AVX2 variant picked on first use.
+// Colors are premultiplied, e.g. qPremultiply(qRgba(255, 0, 0, 128)).
+
+// width 16-bit intensities as opaque grey pixels
+void renderGreyRow(const unsigned short *src, quint32 *dst, int width);
+// Pixels whose mask bit is set blended with a translucent color
+void tintMaskRow(const BitVolume::Word *mask, quint32 color, quint32 *dst, int width);
+// Pixels whose mask bit is set replaced by an opaque color
+void paintMaskRow(const BitVolume::Word *mask, quint32 color, quint32 *dst, int width);
+
+// One pixel blended with a translucent color, rounded the same way as tintMaskRow
+inline quint32 blendPixel(quint32 pixel, quint32 color) {
+    const quint32 inverseAlpha = 255 - (color >> 24);
+    quint32 redBlue = (pixel & 0xff00ffu) * inverseAlpha + 0x800080u;
+    quint32 alphaGreen = ((pixel >> 8) & 0xff00ffu) * inverseAlpha + 0x800080u;
+    redBlue = ((redBlue + ((redBlue >> 8) & 0xff00ffu)) >> 8) & 0xff00ffu;
+    alphaGreen = (alphaGreen + ((alphaGreen >> 8) & 0xff00ffu)) & 0xff00ff00u;
+    return color + (redBlue | alphaGreen);
+}
+
+// Name of the kernel set in use ("scalar", "sse2" or "avx2")
+const char *renderKernelName();
+
+#endif
@@ -0,0 +1,219 @@
+#include "spanfile.h"
+
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#include "rawfile.h"
+
+namespace {
+
+const char spanMagic[4] = {'M', 'R', 'I', 'S'};
+const quint16 spanVersion = 1;
+const int headerBytes = 20;
+
+typedef BitVolume::Word Word;
+
+// First voxel at or after from whose bit equals value, width if there is none
+int nextBit(const Word *row, int from, int width, bool value) {
+    int w = from / BitVolume::wordBits;
+    Word word = (value ? row[w] : ~row[w]) & (~Word(0) << (from % BitVolume::wordBits));
+    while (word == 0) {
+        if (++w * BitVolume::wordBits >= width) { return width; }
+        word = value ? row[w] : ~row[w];
+    }
+    return std::min(width, w * BitVolume::wordBits + BitVolume::lowestBit(word));
+}
+
+void setBits(Word *row, int from, int to) {
+    while (from < to) {
+        const int bit = from % BitVolume::wordBits;
+        const int n = std::min(to - from, BitVolume::wordBits - bit);
+        const Word mask = n == BitVolume::wordBits ? ~Word(0) : ((Word(1) << n) - 1) << bit;
+        row[from / BitVolume::wordBits] |= mask;
+        from += n;
+    }
+}
+
+// Sets the run [start, start + length) of one slice, runs may continue on the next rows
+void setRun(BitVolume &dataArray, int slice, quint32 start, quint32 length) {
+    const auto width = static_cast<quint32>(dataArray.width());
+    while (length > 0) {
+        const quint32 x = start % width;
+        const quint32 n = std::min(length, width - x);
+        setBits(dataArray.row(slice, static_cast<int>(start / width)), static_cast<int>(x), static_cast<int>(x + n));
+        start += n;
+        length -= n;
+    }
+}
+
+// Appends one plane of runs of voxels equal to value
+void encodeCorrectionPlane(const Volume<char> &dataArray, int slice, char value, SliceSpans &spans) {
+    const std::size_t countPos = spans.size();
+    spans.push_back(0);
+    const char *sliceData = dataArray.slice(slice);
+    const auto sliceSize = static_cast<quint32>(dataArray.sliceSize());
+    const auto width = static_cast<quint32>(dataArray.width());
+    for (quint32 rowStart = 0; rowStart < sliceSize; rowStart += width) {
+        const char *row = sliceData + rowStart;
+        quint32 x = 0;
+        while (x < width) {
+            const char *begin = std::find(row + x, row + width, value);
+            if (begin == row + width) { break; }
+            const char *end = std::find_if(begin, row + width, [value](char v) { return v != value; });
+            spans.push_back(rowStart + static_cast<quint32>(begin - row));
+            spans.push_back(static_cast<quint32>(end - begin));
+            spans[countPos]++;
+            x = static_cast<quint32>(end - row);
+        }
+    }
+}
+
+// Maps the file, validates the header and hands every run to apply(slice, plane, start, length).
+// The whole file is checked before the first run is applied, so a damaged file leaves the volume untouched.
+template<typename Apply>
+bool parseSpans(const QString &fileName, int width, int height, int slicesNo, int planes, Apply apply) {
+    RawFile rawFile;
+    if (!rawFile.open(fileName) || rawFile.size() < headerBytes) { return false; }
+
+    const uchar *data = rawFile.data();
+    const uchar *end = data + rawFile.size();
+    if (std::memcmp(data, spanMagic, sizeof(spanMagic)) != 0
+        || qFromLittleEndian<quint16>(data + 4) != spanVersion
+        || qFromLittleEndian<quint16>(data + 6) != planes
+        || qFromLittleEndian<quint32>(data + 8) != static_cast<quint32>(width)
+        || qFromLittleEndian<quint32>(data + 12) != static_cast<quint32>(height)
+        || qFromLittleEndian<quint32>(data + 16) != static_cast<quint32>(slicesNo)) {
+        return false;
+    }
+
+    const quint64 sliceSize = static_cast<quint64>(width) * height;
+    for (const bool applying : {false, true}) {
+        const uchar *curr = data + headerBytes;
+        for (int sl_no = 0; sl_no < slicesNo; sl_no++)
+            for (int plane = 0; plane < planes; plane++) {
+                if (end - curr < 4) { return false; }
+                const quint32 runsNo = qFromLittleEndian<quint32>(curr);
+                curr += 4;
+                if (static_cast<quint64>(end - curr) < 8 * static_cast<quint64>(runsNo)) { return false; }
+                for (quint32 run = 0; run < runsNo; run++, curr += 8) {
+                    const quint32 start = qFromLittleEndian<quint32>(curr);
+                    const quint32 length = qFromLittleEndian<quint32>(curr + 4);
+                    if (static_cast<quint64>(start) + length > sliceSize) { return false; }
+                    if (applying) { apply(sl_no, plane, start, length); }
+                }
+            }
+        if (curr != end) { return false; } // trailing bytes, the file was not written by saveSpans
+    }
+    return true;
+}
+
+}
+
+QString spanFileName(const QString &rawFileName) {
+    QString fileName = rawFileName;
+    if (fileName.endsWith(".raw")) { fileName.chop(4); }
+    return fileName + ".rle";
+}
+
+void encodeSpans(const BitVolume &dataArray, int slice, SliceSpans &spans) {
+    spans.clear();
+    spans.push_back(0);
+    const int width = dataArray.width();
+    for (int y = 0; y < dataArray.height(); y++) {
+        const Word *row = dataArray.row(slice, y);
+        const auto rowStart = static_cast<quint32>(y) * static_cast<quint32>(width);
+        int x = nextBit(row, 0, width, true);
+        while (x < width) {
+            const int end = nextBit(row, x, width, false);
+            spans.push_back(rowStart + static_cast<quint32>(x));
+            spans.push_back(static_cast<quint32>(end - x));
+            spans[0]++;
+            x = end < width ? nextBit(row, end, width, true) : width;
+        }
+    }
+}
+
+void encodeCorrectionSpans(const Volume<char> &dataArray, int slice, SliceSpans &spans) {
+    spans.clear();
+    encodeCorrectionPlane(dataArray, slice, 1, spans);
+    encodeCorrectionPlane(dataArray, slice, -1, spans);
+}
+
+bool saveSpans(const QString &fileName, int width, int height, int planes, const std::vector<SliceSpans> &slices) {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) { return false; }
+
+    uchar header[headerBytes];
+    std::memcpy(header, spanMagic, sizeof(spanMagic));
+    qToLittleEndian<quint16>(spanVersion, header + 4);
+    qToLittleEndian<quint16>(static_cast<quint16>(planes), header + 6);
+    qToLittleEndian<quint32>(static_cast<quint32>(width), header + 8);
+    qToLittleEndian<quint32>(static_cast<quint32>(height), header + 12);
+    qToLittleEndian<quint32>(static_cast<quint32>(slices.size()), header + 16);
+    bool written = file.write(reinterpret_cast<const char *>(header), headerBytes) == headerBytes;
+
+    std::vector<quint32> buffer;
+    for (std::size_t sl_no = 0; written && sl_no < slices.size(); sl_no++) {
+        const SliceSpans &spans = slices[sl_no];
+        buffer.resize(spans.size());
+        qToLittleEndian<quint32>(spans.data(), static_cast<qsizetype>(spans.size()), buffer.data());
+        const auto bytes = static_cast<qint64>(buffer.size() * sizeof(quint32));
+        written = file.write(reinterpret_cast<const char *>(buffer.data()), bytes) == bytes;
+    }
+    if (!written) { file.cancelWriting(); }
+    return file.commit();
+}
+
+bool loadSpans(const QString &fileName, BitVolume &dataArray, int firstSlice, int slicesNo) {
+    if (slicesNo < 0) { slicesNo = dataArray.slices() - firstSlice; }
+    return parseSpans(fileName, dataArray.width(), dataArray.height(), slicesNo, 1,
+                      [&](int sl_no, int, quint32 start, quint32 length) {
+        setRun(dataArray, firstSlice + sl_no, start, length);
+    });
+}
+
+bool loadCorrectionSpans(const QString &fileName, BitVolume &additions, BitVolume &removals,
+                         int firstSlice, int slicesNo) {
+    if (slicesNo < 0) { slicesNo = additions.slices() - firstSlice; }
+    return parseSpans(fileName, additions.width(), additions.height(), slicesNo, 2,
+                      [&](int sl_no, int plane, quint32 start, quint32 length) {
+        setRun(plane == 0 ? additions : removals, firstSlice + sl_no, start, length);
+    });
+}
+
+bool loadCorrectionSpans(const QString &fileName, Volume<char> &dataArray) {
+    return parseSpans(fileName, dataArray.width(), dataArray.height(), dataArray.slices(), 2,
+                      [&](int sl_no, int plane, quint32 start, quint32 length) {
+        std::fill_n(dataArray.slice(sl_no) + start, length, plane == 0 ? 1 : -1);
+    });
+}
+
+bool annotationExists(const QString &rawFileName) {
+    return QFileInfo::exists(spanFileName(rawFileName)) || QFileInfo::exists(rawFileName);
+}
+
+bool loadAnnotation(const QString &rawFileName, BitVolume &dataArray, int firstSlice, int slicesNo) {
+    const QString fileName = spanFileName(rawFileName);
+    if (QFileInfo::exists(fileName)) { return loadSpans(fileName, dataArray, firstSlice, slicesNo); }
+    return loadRaw(rawFileName, dataArray, firstSlice, slicesNo);
+}
+
+bool loadCorrections(const QString &rawFileName, BitVolume &additions, BitVolume &removals,
+                     int firstSlice, int slicesNo) {
+    const QString fileName = spanFileName(rawFileName);
+    if (QFileInfo::exists(fileName)) { return loadCorrectionSpans(fileName, additions, removals, firstSlice, slicesNo); }
+    return loadCorrectionsRaw(rawFileName, additions, removals, firstSlice, slicesNo);
+}
+
+bool loadCorrections(const QString &rawFileName, int width, int height, int slices, Volume<char> &dataArray) {
+    const QString fileName = spanFileName(rawFileName);
+    if (QFileInfo::exists(fileName)) {
+        dataArray = Volume<char>(width, height, slices);
+        return loadCorrectionSpans(fileName, dataArray);
+    }
+    return mapRaw(rawFileName, width, height, slices, dataArray);
+}
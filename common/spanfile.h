@@ -0,0 +1,45 @@
+#ifndef SPANFILE_H
+#define SPANFILE_H
+
+#include <QString>
+
+#include <vector>
+
+#include "bitvolume.h"
+#include "volume.h"
+
+// Compact storage of sparse annotation masks, kept next to the legacy .raw name with an .rle extension.
+// Every slice holds one list of runs per plane - masks have one plane (voxels equal to 1),
+// manual corrections two (voxels equal to 1, then voxels equal to -1).
+// Layout, all numbers little endian:
+//   header: char[4] "MRIS", quint16 version, quint16 planes, quint32 width, quint32 height, quint32 slices
+//   for every slice and plane: quint32 runsNo, then runsNo pairs of quint32 (start, length), start = y * width + x
+
+// Encoded runs of one slice, all planes in file order
+typedef std::vector<quint32> SliceSpans;
+
+QString spanFileName(const QString &rawFileName);
+
+void encodeSpans(const BitVolume &dataArray, int slice, SliceSpans &spans);
+void encodeCorrectionSpans(const Volume<char> &dataArray, int slice, SliceSpans &spans);
+
+// Written through a temporary file renamed over the target, so a crash mid-save never leaves a half-written file
+bool saveSpans(const QString &fileName, int width, int height, int planes, const std::vector<SliceSpans> &slices);
+
+// The header has to match the volume passed in, the file fills slicesNo slices from firstSlice on (all remaining if -1).
+// A damaged file fails before anything is written to the volume.
+bool loadSpans(const QString &fileName, BitVolume &dataArray, int firstSlice = 0, int slicesNo = -1);
+bool loadCorrectionSpans(const QString &fileName, BitVolume &additions, BitVolume &removals,
+                         int firstSlice = 0, int slicesNo = -1);
+bool loadCorrectionSpans(const QString &fileName, Volume<char> &dataArray);
+
+// Annotation loaders taking the legacy .raw name - the compact file is read when present, the .raw file otherwise.
+// A compact file which cannot be read fails the load, the .raw file next to it is older.
+bool annotationExists(const QString &rawFileName);
+bool loadAnnotation(const QString &rawFileName, BitVolume &dataArray, int firstSlice = 0, int slicesNo = -1);
+bool loadCorrections(const QString &rawFileName, BitVolume &additions, BitVolume &removals,
+                     int firstSlice = 0, int slicesNo = -1);
+// dataArray is replaced, .raw files are mapped (see mapRaw)
+bool loadCorrections(const QString &rawFileName, int width, int height, int slices, Volume<char> &dataArray);
+
+#endif
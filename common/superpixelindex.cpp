@@ -0,0 +1,168 @@
+#include "superpixelindex.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+int findRoot(std::vector<int> &parent, int run) {
+    while (parent[run] != run) {
+        parent[run] = parent[parent[run]];
+        run = parent[run];
+    }
+    return run;
+}
+
+void unite(std::vector<int> &parent, int first, int second) {
+    first = findRoot(parent, first);
+    second = findRoot(parent, second);
+    // the older run stays the root, so regions are numbered in the order they start
+    if (first < second) { parent[second] = first; } else { parent[first] = second; }
+}
+
+}
+
+void SuperpixelIndex::build(const Volume<unsigned short> &labels) {
+    slices.assign(labels.slices(), SliceIndex());
+    std::vector<int> sliceNumbers(labels.slices());
+    std::iota(sliceNumbers.begin(), sliceNumbers.end(), 0);
+    QtConcurrent::blockingMap(sliceNumbers, [&](int sl_no) { buildSlice(labels, sl_no, slices[sl_no]); });
+}
+
+void SuperpixelIndex::buildSlice(const Volume<unsigned short> &labels, int slice, SliceIndex &index) {
+    const int width = labels.width();
+    const int height = labels.height();
+
+    // Runs of equal labels, merged with the runs of the row above they touch (diagonally too) by union-find
+    std::vector<unsigned short> runLabels;
+    std::vector<int> parent;
+    index.rowRuns.assign(height + 1, 0);
+    for (int y = 0; y < height; y++) {
+        index.rowRuns[y] = static_cast<int>(index.runs.size());
+        const unsigned short *row = labels.row(slice, y);
+        for (int x = 0; x < width;) {
+            const int left = x;
+            while (x < width && row[x] == row[left]) { x++; }
+            parent.push_back(static_cast<int>(index.runs.size()));
+            index.runs.push_back({static_cast<unsigned short>(left), static_cast<unsigned short>(x - 1), 0});
+            runLabels.push_back(row[left]);
+        }
+        if (y == 0) { continue; }
+
+        int above = index.rowRuns[y - 1];
+        for (int curr = index.rowRuns[y]; curr < static_cast<int>(index.runs.size()); curr++) {
+            // runs above ending before this one starts are passed for good, the runs of a row do not overlap
+            while (index.runs[above].right + 1 < index.runs[curr].left) { above++; }
+            for (int next = above; next < index.rowRuns[y] && index.runs[next].left <= index.runs[curr].right + 1; next++) {
+                if (runLabels[next] == runLabels[curr]) { unite(parent, next, curr); }
+            }
+        }
+    }
+    index.rowRuns[height] = static_cast<int>(index.runs.size());
+
+    // Regions numbered by their first run, then their spans grouped region by region
+    int regions = 0;
+    std::vector<int> spanCount;
+    for (int run = 0; run < static_cast<int>(index.runs.size()); run++) {
+        const int root = findRoot(parent, run);
+        if (root == run) {
+            index.runs[run].region = regions++;
+            spanCount.push_back(0);
+        } else {
+            index.runs[run].region = index.runs[root].region;
+        }
+        spanCount[index.runs[run].region]++;
+    }
+
+    index.regionSpans.assign(regions + 1, 0);
+    std::partial_sum(spanCount.begin(), spanCount.end(), index.regionSpans.begin() + 1);
+    index.spans.resize(index.runs.size());
+    std::vector<int> nextSpan(index.regionSpans.begin(), index.regionSpans.end() - 1);
+    for (int y = 0; y < height; y++) {
+        for (int run = index.rowRuns[y]; run < index.rowRuns[y + 1]; run++) {
+            const Run &curr = index.runs[run];
+            index.spans[nextSpan[curr.region]++] = {static_cast<unsigned short>(y), curr.left, curr.right};
+        }
+    }
+
+    index.states.resize(regions);
+}
+
+int SuperpixelIndex::regionAt(int slice, int x, int y) const {
+    const SliceIndex &index = slices[slice];
+    const auto rowBegin = index.runs.begin() + index.rowRuns[y];
+    const auto rowEnd = index.runs.begin() + index.rowRuns[y + 1];
+    const auto run = std::lower_bound(rowBegin, rowEnd, x, [](const Run &run, int x) { return run.right < x; });
+    return run->region;
+}
+
+void RegionStates::resize(int regions) {
+    marked.assign((regions + BitVolume::wordBits - 1) / BitVolume::wordBits, 0);
+    unmarked.assign(marked.size(), 0);
+}
+
+RegionStates::State RegionStates::state(int region) const {
+    const BitVolume::Word bit = BitVolume::Word(1) << (region % BitVolume::wordBits);
+    if (marked[region / BitVolume::wordBits] & bit) { return Marked; }
+    if (unmarked[region / BitVolume::wordBits] & bit) { return Unmarked; }
+    return Unknown;
+}
+
+void RegionStates::setState(int region, State state) {
+    const BitVolume::Word bit = BitVolume::Word(1) << (region % BitVolume::wordBits);
+    BitVolume::Word &markedWord = marked[region / BitVolume::wordBits];
+    BitVolume::Word &unmarkedWord = unmarked[region / BitVolume::wordBits];
+    markedWord = state == Marked ? markedWord | bit : markedWord & ~bit;
+    unmarkedWord = state == Unmarked ? unmarkedWord | bit : unmarkedWord & ~bit;
+}
+
+void RegionStates::forget() {
+    std::fill(marked.begin(), marked.end(), 0);
+    std::fill(unmarked.begin(), unmarked.end(), 0);
+}
+
+void SupervoxelIndex::build(const Volume<unsigned short> &labels) {
+    const int labelsNo = 65536;
+
+    // Runs of equal labels, slice by slice
+    std::vector<std::vector<Span>> sliceRuns(labels.slices());
+    std::vector<std::vector<unsigned short>> sliceLabels(labels.slices());
+    std::vector<int> sliceNumbers(labels.slices());
+    std::iota(sliceNumbers.begin(), sliceNumbers.end(), 0);
+    QtConcurrent::blockingMap(sliceNumbers, [&](int sl_no) {
+        for (int y = 0; y < labels.height(); y++) {
+            const unsigned short *row = labels.row(sl_no, y);
+            for (int x = 0; x < labels.width();) {
+                const int left = x;
+                while (x < labels.width() && row[x] == row[left]) { x++; }
+                sliceRuns[sl_no].push_back({static_cast<unsigned short>(sl_no), static_cast<unsigned short>(y),
+                                            static_cast<unsigned short>(left), static_cast<unsigned short>(x - 1)});
+                sliceLabels[sl_no].push_back(row[left]);
+            }
+        }
+    });
+
+    // Counting sort by label keeps the slice and row order within a label
+    labelSpans.assign(labelsNo + 1, 0);
+    for (const std::vector<unsigned short> &runLabels : sliceLabels) {
+        for (const unsigned short label : runLabels) { labelSpans[label + 1]++; }
+    }
+    std::partial_sum(labelSpans.begin(), labelSpans.end(), labelSpans.begin());
+    spans.resize(labelSpans[labelsNo]);
+    std::vector<int> nextSpan(labelSpans.begin(), labelSpans.end() - 1);
+    for (int sl_no = 0; sl_no < labels.slices(); sl_no++) {
+        for (std::size_t run = 0; run < sliceRuns[sl_no].size(); run++) {
+            spans[nextSpan[sliceLabels[sl_no][run]]++] = sliceRuns[sl_no][run];
+        }
+    }
+
+    labelStates.resize(labelsNo);
+}
+
+void SupervoxelIndex::clear() {
+    labelSpans.clear();
+    spans.clear();
+    labelStates.resize(0);
+}
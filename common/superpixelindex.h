@@ -0,0 +1,100 @@
+#ifndef SUPERPIXELINDEX_H
+#define SUPERPIXELINDEX_H
+
+#include <vector>
+
+#include "bitvolume.h"
+#include "volume.h"
+
+// What is known about the annotation of whole regions (superpixels, supervoxels), one bit per region
+// for each of the marked and unmarked states. Kept up to date by the code changing the annotation.
+class RegionStates {
+public:
+    enum State { Unknown, Marked, Unmarked };
+
+    void resize(int regions);
+    State state(int region) const;
+    void setState(int region, State state);
+    void forget();
+
+private:
+    std::vector<BitVolume::Word> marked;
+    std::vector<BitVolume::Word> unmarked;
+};
+
+// Superpixels of every slice as lists of row spans, so that a superpixel is selected by walking its spans
+// instead of flood filling the labels. A region is a set of 8-connected pixels of one label (what the
+// flood fill reached); slice by slice the regions are stored compressed row-wise: the spans of region r
+// are spans[regionSpans[r]] up to spans[regionSpans[r + 1]], top to bottom.
+class SuperpixelIndex {
+public:
+    struct Span {
+        unsigned short y;
+        unsigned short left;
+        unsigned short right;
+    };
+
+    // Indexes every slice of labels, slices in parallel
+    void build(const Volume<unsigned short> &labels);
+    void clear() { slices.clear(); }
+    bool isEmpty() const { return slices.empty(); }
+
+    int regionAt(int slice, int x, int y) const;
+    int regionCount(int slice) const { return static_cast<int>(slices[slice].regionSpans.size()) - 1; }
+    const Span *spansBegin(int slice, int region) const {
+        return slices[slice].spans.data() + slices[slice].regionSpans[region];
+    }
+    const Span *spansEnd(int slice, int region) const {
+        return slices[slice].spans.data() + slices[slice].regionSpans[region + 1];
+    }
+
+    RegionStates &states(int slice) { return slices[slice].states; }
+
+private:
+    struct Run {
+        unsigned short left;
+        unsigned short right;
+        int region;
+    };
+    struct SliceIndex {
+        std::vector<int> rowRuns; // first run of every row, height + 1 entries
+        std::vector<Run> runs; // row by row, left to right
+        std::vector<int> regionSpans; // first span of every region, region count + 1 entries
+        std::vector<Span> spans; // region by region
+        RegionStates states;
+    };
+
+    static void buildSlice(const Volume<unsigned short> &labels, int slice, SliceIndex &index);
+
+    std::vector<SliceIndex> slices;
+};
+
+// SLIC supervoxels as lists of row spans over all slices. Unlike superpixels, all voxels of a label
+// make up the supervoxel, connected or not; the spans of label l are spans[labelSpans[l]] up to
+// spans[labelSpans[l + 1]], slice by slice and top to bottom.
+class SupervoxelIndex {
+public:
+    struct Span {
+        unsigned short slice;
+        unsigned short y;
+        unsigned short left;
+        unsigned short right;
+    };
+
+    // Runs of every slice found in parallel, then sorted by label
+    void build(const Volume<unsigned short> &labels);
+    void clear();
+    bool isEmpty() const { return labelSpans.empty(); }
+
+    const Span *spansBegin(unsigned short label) const { return spans.data() + labelSpans[label]; }
+    const Span *spansEnd(unsigned short label) const { return spans.data() + labelSpans[label + 1]; }
+
+    RegionStates &states() { return labelStates; }
+
+private:
+    std::vector<int> labelSpans; // first span of every label, 65537 entries
+    std::vector<Span> spans; // label by label
+    RegionStates labelStates;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+// Contiguous 3D image with slice-major (z, y, x) storage - the same order as .raw files on disk.
+// Owned volumes start every slice on a cache line boundary, rows inside a slice are packed.
+// A volume can also wrap external memory (e.g. a mapped file) kept alive by a shared owner.
+template<typename T>
+class Volume {
+    static_assert(std::is_trivially_copyable<T>::value, "Volume elements must be trivially copyable");
+
+public:
+    static constexpr std::size_t alignment = 64;
+
+    Volume() = default;
+
+    Volume(int width, int height, int slices)
+            : imageWidth(width), imageHeight(height), slicesNo(slices) {
+        const std::size_t perLine = alignment / sizeof(T) > 0 ? alignment / sizeof(T) : 1;
+        pitch = (static_cast<std::size_t>(width) * height + perLine - 1) / perLine * perLine;
+
+        const std::size_t bytes = pitch * slices * sizeof(T);
+        buffer.reset(new unsigned char[bytes + alignment]());
+        auto address = reinterpret_cast<std::uintptr_t>(buffer.get());
+        base = reinterpret_cast<T *>((address + alignment - 1) / alignment * alignment);
+    }
+
+    Volume(T *data, int width, int height, int slices, std::shared_ptr<void> owner)
+            : external(std::move(owner)), base(data), imageWidth(width), imageHeight(height), slicesNo(slices),
+              pitch(static_cast<std::size_t>(width) * height) {}
+
+    Volume(Volume &&other) noexcept { *this = std::move(other); }
+
+    Volume &operator=(Volume &&other) noexcept {
+        if (this != &other) {
+            buffer = std::move(other.buffer);
+            external = std::move(other.external);
+            base = other.base;
+            imageWidth = other.imageWidth;
+            imageHeight = other.imageHeight;
+            slicesNo = other.slicesNo;
+            pitch = other.pitch;
+            other.base = nullptr;
+            other.imageWidth = other.imageHeight = other.slicesNo = 0;
+            other.pitch = 0;
+        }
+        return *this;
+    }
+
+    Volume(const Volume &) = delete;
+    Volume &operator=(const Volume &) = delete;
+
+    T &operator()(int slice, int x, int y) { return base[slice * pitch + static_cast<std::size_t>(y) * imageWidth + x]; }
+    const T &operator()(int slice, int x, int y) const {
+        return base[slice * pitch + static_cast<std::size_t>(y) * imageWidth + x];
+    }
+
+    // Slice view - imageWidth * imageHeight elements, row by row
+    T *slice(int slice) { return base + slice * pitch; }
+    const T *slice(int slice) const { return base + slice * pitch; }
+
+    T *row(int slice, int y) { return base + slice * pitch + static_cast<std::size_t>(y) * imageWidth; }
+    const T *row(int slice, int y) const { return base + slice * pitch + static_cast<std::size_t>(y) * imageWidth; }
+
+    void fill(const T &value) {
+        for (int sl_no = 0; sl_no < slicesNo; sl_no++) { fillSlice(sl_no, value); }
+    }
+
+    void fillSlice(int slice, const T &value) { std::fill_n(this->slice(slice), sliceSize(), value); }
+
+    void clear() { *this = Volume(); }
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int slices() const { return slicesNo; }
+    std::size_t sliceSize() const { return static_cast<std::size_t>(imageWidth) * imageHeight; }
+    std::size_t slicePitch() const { return pitch; }
+    bool isEmpty() const { return base == nullptr; }
+
+private:
+    std::unique_ptr<unsigned char[]> buffer;
+    std::shared_ptr<void> external;
+    T *base = nullptr;
+
+    int imageWidth {};
+    int imageHeight {};
+    int slicesNo {};
+    std::size_t pitch {};
+};
+
+#endif
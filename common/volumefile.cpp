@@ -0,0 +1,158 @@
+#include "volumefile.h"
+
+#include <QFileInfo>
+#include <QStringList>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+const char volumeMagic[4] = {'M', 'R', 'I', 'V'};
+const quint16 volumeVersion = 1;
+
+enum HeaderFlags { BigEndianPayload = 1, SliceOffsetTable = 2 };
+
+float readFloat(const uchar *src) {
+    const quint32 bits = qFromLittleEndian<quint32>(src);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+}
+
+RawFile::~RawFile() {
+    close();
+}
+
+bool RawFile::open(const QString &fileName, Mode mode) {
+    close();
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) { return false; }
+
+    openMode = mode;
+    mappedSize = file.size();
+    if (mappedSize == 0) { return true; } // nothing to map
+
+    mapping = file.map(0, mappedSize, mode == CopyOnWrite ? QFileDevice::MapPrivateOption : QFileDevice::NoOptions);
+    if (mapping == nullptr) {
+        file.close();
+        mappedSize = 0;
+        return false;
+    }
+    return true;
+}
+
+void RawFile::close() {
+    if (mapping != nullptr) {
+        file.unmap(mapping);
+        mapping = nullptr;
+    }
+    if (file.isOpen()) { file.close(); }
+    mappedSize = 0;
+}
+
+bool VolumeFile::open(const QString &fileName, const VolumeInfo &legacyInfo, RawFile::Mode mode) {
+    close();
+    if (!rawFile.open(fileName, mode)) { return false; }
+
+    headerPresent = rawFile.size() >= headerBytes
+                    && std::memcmp(rawFile.data(), volumeMagic, sizeof(volumeMagic)) == 0;
+    if (headerPresent) {
+        if (!parseHeader()) {
+            close();
+            return false;
+        }
+    } else {
+        volumeInfo = legacyInfo;
+        sliceOffsets.resize(volumeInfo.slices);
+        for (int sl_no = 0; sl_no < volumeInfo.slices; sl_no++) {
+            sliceOffsets[sl_no] = volumeInfo.sliceBytes() * sl_no;
+        }
+        contiguous = true;
+    }
+
+    // every slice has to lie inside the file
+    for (qint64 offset : sliceOffsets) {
+        if (offset < 0 || offset + volumeInfo.sliceBytes() > rawFile.size()) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void VolumeFile::close() {
+    rawFile.close();
+    volumeInfo = VolumeInfo();
+    sliceOffsets.clear();
+    headerPresent = false;
+    contiguous = false;
+}
+
+bool VolumeFile::parseHeader() {
+    const uchar *header = rawFile.data();
+    const quint8 dataType = header[6];
+    const quint8 flags = header[7];
+    if (qFromLittleEndian<quint16>(header + 4) != volumeVersion
+        || dataType < VolumeInfo::UInt8 || dataType > VolumeInfo::UInt16) {
+        return false;
+    }
+
+    const quint32 width = qFromLittleEndian<quint32>(header + 8);
+    const quint32 height = qFromLittleEndian<quint32>(header + 12);
+    const quint32 slices = qFromLittleEndian<quint32>(header + 16);
+    if (width == 0 || height == 0 || width > 65535 || height > 65535 || slices > 65535) { return false; }
+
+    volumeInfo.dataType = static_cast<VolumeInfo::DataType>(dataType);
+    volumeInfo.bigEndian = flags & BigEndianPayload;
+    volumeInfo.width = static_cast<int>(width);
+    volumeInfo.height = static_cast<int>(height);
+    volumeInfo.slices = static_cast<int>(slices);
+    for (int axis = 0; axis < 3; axis++) { volumeInfo.spacing[axis] = readFloat(header + 20 + 4 * axis); }
+
+    sliceOffsets.resize(slices);
+    contiguous = true;
+    if (flags & SliceOffsetTable) {
+        if (rawFile.size() < headerBytes + 8 * static_cast<qint64>(slices)) { return false; }
+        for (quint32 sl_no = 0; sl_no < slices; sl_no++) {
+            const quint64 offset = qFromLittleEndian<quint64>(header + headerBytes + 8 * sl_no);
+            if (offset > static_cast<quint64>(rawFile.size())) { return false; }
+            sliceOffsets[sl_no] = static_cast<qint64>(offset);
+            contiguous = contiguous && sliceOffsets[sl_no] == sliceOffsets[0] + volumeInfo.sliceBytes() * sl_no;
+        }
+    } else {
+        const quint64 payloadOffset = qFromLittleEndian<quint64>(header + 32);
+        if (payloadOffset > static_cast<quint64>(rawFile.size())) { return false; }
+        for (quint32 sl_no = 0; sl_no < slices; sl_no++) {
+            sliceOffsets[sl_no] = static_cast<qint64>(payloadOffset) + volumeInfo.sliceBytes() * sl_no;
+        }
+    }
+    return true;
+}
+
+VolumeInfo volumeInfoFromFileName(const QString &fileName) {
+    VolumeInfo info;
+    const QStringList params = QFileInfo(fileName).fileName().split("_");
+    if (params.size() < 5) { return info; }
+
+    bool widthOk = false, heightOk = false, slicesOk = false;
+    const int width = params[params.size() - 5].toInt(&widthOk);
+    const int height = params[params.size() - 4].toInt(&heightOk);
+    const int slices = params[params.size() - 3].toInt(&slicesOk);
+    if (widthOk && heightOk && slicesOk && width > 0 && height > 0 && slices > 0) {
+        info.width = width;
+        info.height = height;
+        info.slices = slices;
+    }
+    return info;
+}
+
+bool readVolumeInfo(const QString &fileName, const VolumeInfo &legacyInfo, VolumeInfo &info) {
+    VolumeFile volumeFile;
+    if (!volumeFile.open(fileName, legacyInfo)) { return false; }
+    info = volumeFile.info();
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef VOLUMEFILE_H
+#define VOLUMEFILE_H
+
+#include <QFile>
+#include <QString>
+
+#include <vector>
+
+// Memory mapping of a volume file. Pages are only read from disk when touched.
+class RawFile {
+public:
+    enum Mode { ReadOnly, CopyOnWrite };
+
+    RawFile() = default;
+    ~RawFile();
+    RawFile(const RawFile &) = delete;
+    RawFile &operator=(const RawFile &) = delete;
+
+    bool open(const QString &fileName, Mode mode = ReadOnly);
+    void close();
+
+    bool isOpen() const { return file.isOpen(); }
+    const uchar *data() const { return mapping; }
+    uchar *writableData() { return openMode == CopyOnWrite ? mapping : nullptr; } // changes never reach the file
+    qint64 size() const { return mappedSize; }
+
+private:
+    QFile file;
+    uchar *mapping = nullptr;
+    qint64 mappedSize = 0;
+    Mode openMode = ReadOnly;
+};
+
+// Self-describing volume files - a fixed header, an optional slice offset table and the payload.
+// Header, all numbers little endian:
+//    0 char[4] "MRIV"        4 quint16 version      6 quint8 data type       7 quint8 flags
+//    8 quint32 width        12 quint32 height      16 quint32 slices
+//   20 float spacing x, y, z in mm (0 when unknown)
+//   32 quint64 payload offset (first slice when there is no offset table)    40..63 reserved
+// Flags: bit 0 - big endian payload, bit 1 - slices quint64 absolute slice offsets follow the header.
+// Legacy .raw files are the bare payload, their layout has to be known up front.
+struct VolumeInfo {
+    enum DataType { UInt8 = 1, Int8 = 2, UInt16 = 3 };
+
+    VolumeInfo() = default;
+    VolumeInfo(DataType dataType, int width, int height, int slices)
+            : dataType(dataType), width(width), height(height), slices(slices) {}
+
+    DataType dataType = UInt16;
+    bool bigEndian = true;
+    int width {};
+    int height {};
+    int slices {};
+    float spacing[3] {}; // mm
+
+    int bytesPerVoxel() const { return dataType == UInt16 ? 2 : 1; }
+    qint64 sliceBytes() const { return static_cast<qint64>(width) * height * bytesPerVoxel(); }
+    bool hasSpacing() const { return spacing[0] > 0 && spacing[1] > 0 && spacing[2] > 0; }
+    bool sameLayout(const VolumeInfo &other) const {
+        return dataType == other.dataType && width == other.width && height == other.height && slices == other.slices;
+    }
+};
+
+// Mapped volume file with direct access to every slice
+class VolumeFile {
+public:
+    static constexpr int headerBytes = 64;
+
+    // Files without a header are taken to hold the legacy layout as long as they are large enough for it
+    bool open(const QString &fileName, const VolumeInfo &legacyInfo, RawFile::Mode mode = RawFile::ReadOnly);
+    void close();
+
+    bool isOpen() const { return rawFile.isOpen(); }
+    bool hasHeader() const { return headerPresent; }
+    const VolumeInfo &info() const { return volumeInfo; }
+
+    const uchar *slice(int slice) const { return rawFile.data() + sliceOffsets[slice]; }
+    uchar *writableSlice(int slice) { return rawFile.writableData() + sliceOffsets[slice]; }
+    // Slices stored one after another from slice(0) on, so the payload can be used as a whole
+    bool isContiguous() const { return contiguous; }
+
+private:
+    bool parseHeader();
+
+    RawFile rawFile;
+    VolumeInfo volumeInfo;
+    std::vector<qint64> sliceOffsets;
+    bool headerPresent = false;
+    bool contiguous = false;
+};
+
+// Layout of a legacy 16-bit big endian file taken from its name (..._<width>_<height>_<slices>_<n>_.raw),
+// the dimensions are 0 when the name does not follow that pattern
+VolumeInfo volumeInfoFromFileName(const QString &fileName);
+// Header of a volume file, the legacy layout is used as in VolumeFile::open
+bool readVolumeInfo(const QString &fileName, const VolumeInfo &legacyInfo, VolumeInfo &info);
+
+#endif
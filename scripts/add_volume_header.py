@@ -0,0 +1,48 @@
+import os
+import sys
+import struct
+
+HEADER_BYTES = 64
+VERSION = 1
+DATA_TYPES = {1: 1, 2: 3}  # bytes per voxel -> data type (1 - uint8, 3 - uint16)
+BIG_ENDIAN_PAYLOAD = 1
+
+
+def volume_header(width, height, slices_no, nbytes, spacing=(0.0, 0.0, 0.0)):
+    header = struct.pack('<4sHBBIII3fQ', b'MRIV', VERSION, DATA_TYPES[nbytes], BIG_ENDIAN_PAYLOAD,
+                         width, height, slices_no, *spacing, HEADER_BYTES)
+    return header + bytes(HEADER_BYTES - len(header))
+
+
+def add_volume_header(filepath, out_filepath, spacing=(0.0, 0.0, 0.0)):
+    # legacy names end with <width>_<height>_<slices>_<n>_.raw
+    params = os.path.basename(filepath).split('_')
+    width, height, slices_no = int(params[-5]), int(params[-4]), int(params[-3])
+
+    with open(filepath, "rb") as f:
+        if f.read(4) == b'MRIV':
+            print(f'{filepath} already has a header')
+            return
+        f.seek(0)
+        payload = f.read()
+
+    nbytes = len(payload) // (width * height * slices_no)
+    if nbytes not in DATA_TYPES or len(payload) != nbytes * width * height * slices_no:
+        print(f'{filepath} does not match its dimensions')
+        return
+
+    with open(out_filepath, "wb") as f:
+        f.write(volume_header(width, height, slices_no, nbytes, spacing))
+        f.write(payload)
+
+
+if __name__ == '__main__':
+    # usage: add_volume_header.py <input dir> <output dir> [spacing x y z in mm]
+    IN_DIR = sys.argv[1]
+    OUT_DIR = sys.argv[2]
+    SPACING = tuple(float(s) for s in sys.argv[3:6]) if len(sys.argv) >= 6 else (0.0, 0.0, 0.0)
+
+    os.makedirs(OUT_DIR, exist_ok=True)
+    for filename in os.listdir(IN_DIR):
+        if filename.endswith(".raw"):
+            add_volume_header(IN_DIR + '/' + filename, OUT_DIR + '/' + filename, SPACING)
@@ -4,6 +4,7 @@ import altair as alt
 import matplotlib as mpl
 import matplotlib.pyplot as plt
 import os
+import struct
 
 # ANN_DIR = '/home/daniel/Pulpit/!FinalAnnotationsTask/annotations'
 ANN_DIR = '/home/daniel/Pulpit/!FinalAnnotationsTask/annotations_postprocessed'
@@ -43,6 +44,42 @@ def read_binary_data(filepath, img_size, slices_no, signed=False):
     return img
 
 
+def read_span_data(filepath, signed=False):
+    # compact annotation files, see common/spanfile.h
+    f = open(filepath, "rb")
+    _, _, planes, width, height, slices_no = struct.unpack('<4sHHIII', f.read(20))
+    img = np.zeros((slices_no, height * width), dtype=np.int8 if signed else np.uint8)
+    for i in range(slices_no):
+        for plane_value in (1, -1)[:planes]:
+            runs_no, = struct.unpack('<I', f.read(4))
+            runs = np.frombuffer(f.read(8 * runs_no), dtype='<u4').reshape(-1, 2)
+            for start, length in runs:
+                img[i, start:start + length] = plane_value
+    f.close()
+    return img.reshape((slices_no, height, width)).transpose(1, 2, 0)
+
+
+def read_annotation_data(filepath, img_size, slices_no, signed=False):
+    if filepath.endswith(".rle"):
+        return read_span_data(filepath, signed)
+    return read_binary_data(filepath, img_size, slices_no, signed)
+
+
+def read_combined_data(directory, manual_filename):
+    # combined annotation saved by the annotation manager next to the sp and manual ones, None when not saved
+    filepath = f'{directory}/{manual_filename[:-4].replace("manualAnnotations", "combinedAnnotations")}.rle'
+    if not os.path.exists(filepath):
+        return None
+    return read_span_data(filepath, signed=False)
+
+
+def annotation_files(directory):
+    # compact .rle files replace the legacy .raw files of the same annotation
+    filenames = os.listdir(directory)
+    return [filename for filename in filenames
+            if filename.endswith(".rle") or (filename.endswith(".raw") and filename[:-4] + ".rle" not in filenames)]
+
+
 def load_data():
     manual_annotations = {}
     combined_annotations = {}
@@ -61,8 +98,8 @@ def load_data():
         if rater in RATERS:
             for ann_type in (os.listdir(f'{ANN_DIR}/{rater}/sp')):
                 if ann_type in ANN_TYPES:
-                    for case_filename in os.listdir(f'{ANN_DIR}/{rater}/sp/{ann_type}'):
-                        if case_filename.endswith(".raw"):
+                    for case_filename in annotation_files(f'{ANN_DIR}/{rater}/sp/{ann_type}'):
+                        if case_filename.endswith((".raw", ".rle")):
                             _, case_no, img_size, _, slices_no, _, _ = case_filename.split('_')
                             img_size = int(img_size)
                             slices_no = int(slices_no)
@@ -71,13 +108,13 @@ def load_data():
                                     (ann_type[:4] == 'KNEE' and case_no not in KNEE_CASE_LIST):
                                 continue
                             sp_annotations[ann_type][case_no][rater] = \
-                                read_binary_data(f'{ANN_DIR}/{rater}/sp/{ann_type}/{case_filename}',
-                                                 img_size, slices_no, signed=False)
+                                read_annotation_data(f'{ANN_DIR}/{rater}/sp/{ann_type}/{case_filename}',
+                                                     img_size, slices_no, signed=False)
 
             for ann_type in (os.listdir(f'{ANN_DIR}/{rater}/manual')):
                 if ann_type in ANN_TYPES:
-                    for case_filename in os.listdir(f'{ANN_DIR}/{rater}/manual/{ann_type}'):
-                        if case_filename.endswith(".raw"):
+                    for case_filename in annotation_files(f'{ANN_DIR}/{rater}/manual/{ann_type}'):
+                        if case_filename.endswith((".raw", ".rle")):
                             _, case_no, img_size, _, slices_no, _, _ = case_filename.split('_')
                             img_size = int(img_size)
                             slices_no = int(slices_no)
@@ -86,13 +123,16 @@ def load_data():
                                     (ann_type[:4] == 'KNEE' and case_no not in KNEE_CASE_LIST):
                                 continue
                             manual_annotations[ann_type][case_no][rater] = \
-                                read_binary_data(f'{ANN_DIR}/{rater}/manual/{ann_type}/{case_filename}',
-                                                 img_size, slices_no, signed=True)
+                                read_annotation_data(f'{ANN_DIR}/{rater}/manual/{ann_type}/{case_filename}',
+                                                     img_size, slices_no, signed=True)
 
                             if ann_type[-6:] != "MANUAL":
                                 combined_annotations[ann_type][case_no][rater] = \
-                                    sp_annotations[ann_type][case_no][rater] + \
-                                    manual_annotations[ann_type][case_no][rater]
+                                    read_combined_data(f'{ANN_DIR}/{rater}/combined/{ann_type}', case_filename)
+                                if combined_annotations[ann_type][case_no][rater] is None:
+                                    combined_annotations[ann_type][case_no][rater] = \
+                                        sp_annotations[ann_type][case_no][rater] + \
+                                        manual_annotations[ann_type][case_no][rater]
 
                                 assert np.max(sp_annotations[ann_type][case_no][rater]) in (0, 1), \
                                     f'SP max value incorrect for {ann_type}, {rater}'